@@ -0,0 +1,204 @@
+/*
+ * fasta-bench.cpp
+ *
+ * Description: Times the main FASTAFile and FASTAReader operations on a
+ *              synthetic reference.
+ *
+ * Usage: fasta-bench [-m MEGABASES] [-r RECORDS] [-w WIDTH] [-n QUERIES]
+ *                    [-l LENGTH] [-d DIR] [-k]
+ *   Writes a random reference of MEGABASES million bases (default 256) split
+ *   into RECORDS records (default 8) with WIDTH bases per line (default 60)
+ *   to DIR (default /tmp), then reports time per query or throughput for
+ *   each operation. QUERIES random regions of LENGTH bases (defaults 100000
+ *   and 100) are used for the lookup tests. -k keeps the generated file.
+ *
+ * Copyright 2019 Will Eccles
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fasta.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+struct Options {
+    std::size_t megabases = 256;
+    std::size_t records = 8;
+    std::size_t width = 60;
+    std::size_t queries = 100000;
+    std::size_t length = 100;
+    std::string dir = "/tmp";
+    bool keep = false;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// prints one result as time per query and throughput
+void report(const char* what, double secs, std::size_t queries, std::size_t bytes) {
+    std::printf("%-32s %10.1f ns/query %10.1f MB/s\n", what, secs * 1e9 / queries, bytes / secs / 1e6);
+}
+
+// writes a reference of random bases with some soft-masked and N runs
+void generate(const std::string& path, const Options& opt, std::vector<std::size_t>& lengths) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Error writing " + path + "!");
+    std::mt19937_64 rng(42);
+    std::size_t total = opt.megabases * 1000000;
+    std::string line;
+    for (std::size_t r = 0; r < opt.records; r++) {
+        std::size_t n = total / opt.records + (r < total % opt.records);
+        lengths.push_back(n);
+        out << ">chr" << r + 1 << " synthetic\n";
+        bool lower = false;
+        bool gap = false;
+        for (std::size_t done = 0; done < n;) {
+            std::size_t k = std::min(opt.width, n - done);
+            line.resize(k);
+            for (std::size_t i = 0; i < k; i++) {
+                std::uint64_t x = rng();
+                if ((x >> 40) % 5000 == 0) lower = !lower;
+                if ((x >> 20) % 20000 == 0) gap = !gap;
+                char c = gap ? 'N' : "ACGT"[x & 3];
+                line[i] = lower ? c | 0x20 : c;
+            }
+            out << line << '\n';
+            done += k;
+        }
+    }
+    if (!out.flush()) throw std::runtime_error("Error writing " + path + "!");
+}
+
+void bench_lookups(const std::string& path, FASTAFile::Backend backend, const char* label, const Options& opt,
+        const std::vector<FASTAFile::Region>& regions) {
+    FASTAFile fa(path, backend);
+    std::string buf;
+    std::size_t bases = 0;
+    char name[64];
+
+    for (bool caps : {false, true}) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (const auto& r : regions) bases += fa.get_sequence_into(buf, r.name, r.start, r.end, caps);
+        std::snprintf(name, sizeof(name), "%s fetch%s", label, caps ? " caps" : "");
+        report(name, seconds_since(t0), regions.size(), opt.length * regions.size());
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (const auto& r : regions) {
+        bases += fa.get_sequence_into(buf, r.name, r.start, r.end, FASTAFile::Strand::Reverse);
+    }
+    std::snprintf(name, sizeof(name), "%s fetch reverse", label);
+    report(name, seconds_since(t0), regions.size(), opt.length * regions.size());
+
+    t0 = std::chrono::steady_clock::now();
+    std::vector<std::string> all = fa.get_sequences(regions);
+    std::snprintf(name, sizeof(name), "%s get_sequences", label);
+    report(name, seconds_since(t0), regions.size(), opt.length * regions.size());
+
+    // whole records, as one large extraction each
+    t0 = std::chrono::steady_clock::now();
+    std::size_t total = 0;
+    for (const auto& rec : fa.index()) total += fa.get_sequence_into(buf, rec.name, 1, rec.length);
+    std::snprintf(name, sizeof(name), "%s whole records", label);
+    report(name, seconds_since(t0), fa.index().size(), total);
+
+    if (bases == 0 || all.size() != regions.size()) std::printf("(unexpected empty result)\n");
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-k") {
+            opt.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "usage: " << argv[0]
+                << " [-m MEGABASES] [-r RECORDS] [-w WIDTH] [-n QUERIES] [-l LENGTH] [-d DIR] [-k]\n";
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "-m") opt.megabases = std::strtoul(value, nullptr, 10);
+        else if (arg == "-r") opt.records = std::strtoul(value, nullptr, 10);
+        else if (arg == "-w") opt.width = std::strtoul(value, nullptr, 10);
+        else if (arg == "-n") opt.queries = std::strtoul(value, nullptr, 10);
+        else if (arg == "-l") opt.length = std::strtoul(value, nullptr, 10);
+        else if (arg == "-d") opt.dir = value;
+        else {
+            std::cerr << argv[0] << ": unknown option " << arg << '\n';
+            return 2;
+        }
+    }
+    if (opt.records == 0 || opt.width == 0 || opt.length == 0
+            || opt.megabases * 1000000 / opt.records < opt.length) {
+        std::cerr << argv[0] << ": records must be longer than the query length\n";
+        return 2;
+    }
+
+    std::string path = opt.dir + "/fasta-bench.fa";
+    try {
+        std::vector<std::size_t> lengths;
+        auto t0 = std::chrono::steady_clock::now();
+        generate(path, opt, lengths);
+        std::printf("generated %zu Mb in %zu records, %zu bases per line (%.1f s)\n\n",
+            opt.megabases, opt.records, opt.width, seconds_since(t0));
+        std::ifstream probe(path, std::ios::binary | std::ios::ate);
+        std::size_t file_size = probe.tellg();
+
+        FASTAFile fa(path);
+        t0 = std::chrono::steady_clock::now();
+        fa.build_index();
+        report("build_index", seconds_since(t0), 1, file_size);
+        t0 = std::chrono::steady_clock::now();
+        fa.build_index(0);
+        report("build_index all threads", seconds_since(t0), 1, file_size);
+        if (!fa.write_index(path + ".fai")) throw std::runtime_error("Error writing " + path + ".fai!");
+
+        t0 = std::chrono::steady_clock::now();
+        std::size_t records = 0;
+        for (auto& rec : FASTAReader(path)) records += !rec.sequence.empty();
+        report("FASTAReader", seconds_since(t0), records, file_size);
+
+        std::mt19937_64 rng(7);
+        std::vector<FASTAFile::Region> regions(opt.queries);
+        for (auto& r : regions) {
+            std::size_t rec = rng() % opt.records;
+            r.name = "chr" + std::to_string(rec + 1);
+            r.start = 1 + rng() % (lengths[rec] - opt.length + 1);
+            r.end = r.start + opt.length - 1;
+        }
+        std::printf("\n%zu random regions of %zu bases:\n", opt.queries, opt.length);
+        bench_lookups(path, FASTAFile::Backend::Stream, "stream", opt, regions);
+#ifdef FASTA_HAVE_POSIX
+        bench_lookups(path, FASTAFile::Backend::Mmap, "mmap", opt, regions);
+#endif
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+
+    if (!opt.keep) {
+        std::remove(path.c_str());
+        std::remove((path + ".fai").c_str());
+    }
+    return 0;
+}
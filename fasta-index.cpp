@@ -0,0 +1,65 @@
+/*
+ * fasta-index.cpp
+ *
+ * Description: Builds samtools-compatible .fai indexes for FASTA files.
+ *
+ * Usage: fasta-index [-t THREADS] FILE...
+ *   Writes FILE.fai next to each FILE, and FILE.gzi for BGZF-compressed files.
+ *   -t scans each file on THREADS threads, or one per core for 0.
+ *
+ * Copyright 2019 Will Eccles
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fasta.h"
+
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    // -t N scans each file on N threads, or one per core for 0
+    unsigned threads = 1;
+    int first = 1;
+    if (argc > 2 && std::string(argv[1]) == "-t") {
+        threads = std::strtoul(argv[2], nullptr, 10);
+        first = 3;
+    }
+    if (argc <= first) {
+        std::cerr << "usage: " << argv[0] << " [-t THREADS] FILE...\n";
+        return 2;
+    }
+
+    int ret = 0;
+    for (int i = first; i < argc; i++) {
+        std::string path = argv[i];
+        try {
+            FASTAFile fa;
+            if (!fa.open(path)) {
+                throw std::runtime_error("Error opening file: " + path + "!");
+            }
+            fa.build_index(threads);
+            if (!fa.write_index(path + ".fai")) {
+                throw std::runtime_error("Error writing " + path + ".fai!");
+            }
+#ifdef FASTA_USE_ZLIB
+            if (fa.compression() == FASTAFile::Compression::Bgzf && !fa.write_gzi(path + ".gzi")) {
+                throw std::runtime_error("Error writing " + path + ".gzi!");
+            }
+#endif
+        } catch (const std::exception& e) {
+            std::cerr << argv[0] << ": " << path << ": " << e.what() << '\n';
+            ret = 1;
+        }
+    }
+    return ret;
+}
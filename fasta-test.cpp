@@ -0,0 +1,1386 @@
+/*
+ * fasta-test.cpp
+ *
+ * Description: Checks the library against small generated files and plain
+ *              reference implementations.
+ *
+ * Usage: fasta-test [-d DIR]
+ *   Writes its test files to DIR (default /tmp) and removes them after.
+ *   Prints each failed check and exits with 1 if there were any.
+ *
+ * Copyright 2019 Will Eccles
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fasta.h"
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef FASTA_HAVE_POSIX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+namespace {
+
+int failures = 0;
+std::vector<std::string> created;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(bool ok, const char* what, int line) {
+    if (ok) return;
+    std::printf("  line %d: CHECK(%s) failed\n", line, what);
+    failures++;
+}
+
+// true if fn throws an E
+template <class E = std::runtime_error, class F>
+bool throws(F fn) {
+    try {
+        fn();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+// writes a test file, which is removed when the tests finish
+std::string write_file(const std::string& dir, const std::string& name, const std::string& content) {
+    std::string path = dir + "/" + name;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << content;
+    if (!out.flush()) throw std::runtime_error("Error writing " + path + "!");
+    created.push_back(path);
+    return path;
+}
+
+std::string random_bytes(std::mt19937_64& rng, std::size_t n, const char* alphabet) {
+    std::size_t k = std::strlen(alphabet);
+    std::string s(n, '\0');
+    for (auto& c : s) c = alphabet[rng() % k];
+    return s;
+}
+
+// a FASTA file of random records, with their bases concatenated in all
+std::string random_fasta(std::mt19937_64& rng, std::size_t records, std::size_t width, std::string& all) {
+    std::string text;
+    all.clear();
+    for (std::size_t r = 0; r < records; r++) {
+        std::string seq = random_bytes(rng, 1 + rng() % 5000, "ACGTacgtN");
+        all += seq;
+        text += ">chr" + std::to_string(r + 1) + " record " + std::to_string(r + 1) + "\n";
+        for (std::size_t i = 0; i < seq.size(); i += width) text += seq.substr(i, width) + "\n";
+    }
+    return text;
+}
+
+// every kernel this build and CPU can run, scalar first
+template <class Fn>
+std::vector<Fn> kernels(Fn scalar, Fn sse2, Fn avx2, Fn neon) {
+    std::vector<Fn> ret{scalar};
+    (void)sse2;
+    (void)avx2;
+    (void)neon;
+#if defined(__aarch64__)
+    ret.push_back(neon);
+#elif defined(__SSE2__) || defined(_M_X64)
+    ret.push_back(sse2);
+#ifdef FASTA_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) ret.push_back(avx2);
+#endif
+#endif
+    return ret;
+}
+
+#if defined(__aarch64__)
+#define KERNELS(name) kernels(fasta_detail::name##_scalar, fasta_detail::name##_scalar, \
+    fasta_detail::name##_scalar, fasta_detail::name##_neon)
+#elif (defined(__SSE2__) || defined(_M_X64)) && defined(FASTA_HAVE_AVX2)
+#define KERNELS(name) kernels(fasta_detail::name##_scalar, fasta_detail::name##_sse2, \
+    fasta_detail::name##_avx2, fasta_detail::name##_scalar)
+#elif defined(__SSE2__) || defined(_M_X64)
+#define KERNELS(name) kernels(fasta_detail::name##_scalar, fasta_detail::name##_sse2, \
+    fasta_detail::name##_scalar, fasta_detail::name##_scalar)
+#else
+#define KERNELS(name) kernels(fasta_detail::name##_scalar, fasta_detail::name##_scalar, \
+    fasta_detail::name##_scalar, fasta_detail::name##_scalar)
+#endif
+
+// a .fai that can't be right is reported with its line, whatever is wrong
+void test_malformed_index(const std::string& dir) {
+    std::string path = write_file(dir, "fai.fa", ">chr1\nACGTA\nCG\n");
+    const char* bad[] = {
+        "chr1\t7\t6\t5\n",
+        "chr1\t7\t6\tfive\t6\n",
+        "chr1\t99999999999999999999999\t6\t5\t6\n",
+        "chr1\t7\t6\t5\t4\n",
+    };
+    for (const char* fai : bad) {
+        write_file(dir, "fai.fa.fai", std::string("chr1\t7\t6\t5\t6\n") + fai);
+        try {
+            FASTAFile fa(path);
+            fa.load_index(path + ".fai");
+            CHECK(false);
+        } catch (const std::runtime_error& e) {
+            CHECK(std::string(e.what()).find("at line 2") != std::string::npos);
+        }
+
+        // open() finds it too, and doesn't keep the file open
+        FASTAFile fa;
+        CHECK(throws([&] { fa.open(path); }));
+        CHECK(!fa.has_index());
+        write_file(dir, "fai.fa.fai", "chr1\t7\t6\t5\t6\n");
+        CHECK(fa.open(path) && fa.has_index() && fa.get_sequence(1, 7) == "ACGTACG");
+    }
+}
+
+// global coordinates count the same bases on every backend, with or
+// without a .fai on disk
+void test_global_coordinates(const std::string& dir) {
+    std::mt19937_64 rng(2);
+    std::string all;
+    std::string path = write_file(dir, "global.fa", random_fasta(rng, 6, 61, all));
+    for (int round = 0; round < 2; round++) {
+        FASTAFile stream(path, FASTAFile::Backend::Stream);
+        FASTAFile mapped(path, FASTAFile::Backend::Mmap);
+        for (int i = 0; i < 200; i++) {
+            std::size_t start = 1 + rng() % all.size();
+            std::size_t end = start + rng() % std::min<std::size_t>(all.size() - start + 1, 8000);
+            std::string want = all.substr(start - 1, end - start + 1);
+            CHECK(stream.get_sequence(start, end) == want);
+            CHECK(mapped.get_sequence(start, end) == want);
+        }
+        CHECK(stream.get_sequence(1, 5) == all.substr(0, 5));
+        CHECK(throws([&] { stream.get_sequence(1, all.size() + 1); }));
+        CHECK(throws([&] { mapped.get_sequence(all.size(), all.size() + 1); }));
+        if (round == 0) CHECK(stream.write_index(path + ".fai"));
+    }
+}
+
+// the vector kernels must agree with the scalar ones at every length and
+// alignment, with line endings and odd bytes anywhere
+void test_strip_kernels(const std::string&) {
+    std::mt19937_64 rng(1);
+    auto strip = KERNELS(strip_copy);
+    for (int round = 0; round < 2000; round++) {
+        std::size_t n = rng() % 300;
+        std::size_t skew = rng() % 32;
+        const char* alphabet = round % 3 == 0 ? "ACGTacgtN\n" : round % 3 == 1 ? "ACGTNRYacgtn\r\n*-@" : "ACGT";
+        std::string src = std::string(skew, 'x') + random_bytes(rng, n, alphabet);
+        const char* p = src.data() + skew;
+
+        for (bool caps : {false, true}) {
+            std::string want(n, '\0');
+            std::size_t k = fasta_detail::strip_copy_scalar(&want[0], p, n, caps);
+            for (auto fn : strip) {
+                std::string got(n, '\0');
+                CHECK(fn(&got[0], p, n, caps) == k && got.compare(0, k, want, 0, k) == 0);
+                std::string in_place(p, n);
+                CHECK(fn(&in_place[0], in_place.data(), n, caps) == k && in_place.compare(0, k, want, 0, k) == 0);
+            }
+        }
+    }
+}
+
+// a line ending where the index has bases must fail, never shift the bases
+void test_line_endings(const std::string& dir) {
+    std::string path = write_file(dir, "stray.fa", ">c1\nAC\rGT\nACGTA\nA\n");
+    write_file(dir, "stray.fa.fai", "c1\t11\t4\t5\t6\n");
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        CHECK(throws([&] { fa.get_sequence("c1", 1, 11); }));
+        CHECK(throws([&] { fa.get_sequence("c1", 1, 11, true); }));
+        CHECK(fa.get_sequence("c1", 6, 11) == "ACGTAA");
+    }
+
+    // while \r\n line endings are fine
+    std::string crlf = write_file(dir, "crlf.fa", ">c1\r\nACGTA\r\nACGTA\r\nA\r\n>c2\r\nTT\r\n");
+    FASTAFile ok(crlf);
+    CHECK(ok.get_sequence("c1", 1, 11) == "ACGTAACGTAA");
+    CHECK(ok.get_sequence("c2", 1, 2) == "TT");
+    CHECK(ok.get_sequence("c1", 4, 8) == "TAACG");
+}
+
+// a batch returns what one lookup per region would, whatever the order,
+// overlap or spacing of the regions
+void test_batched(const std::string& dir) {
+    std::mt19937_64 rng(9);
+    std::string all;
+    std::string path = write_file(dir, "batch.fa", random_fasta(rng, 8, 60, all));
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        fa.build_index();
+        std::vector<FASTAFile::Region> regions;
+        for (int i = 0; i < 300; i++) {
+            std::string name = "chr" + std::to_string(1 + rng() % 8);
+            std::size_t len = fa.find_record(name)->length;
+            std::size_t start = 1 + rng() % len;
+            std::size_t end = start + rng() % std::min<std::size_t>(len - start + 1, 700);
+            regions.push_back({name, start, end});
+            if (i % 10 == 0) regions.push_back(regions.back());
+        }
+        for (bool caps : {false, true}) {
+            std::vector<std::string> got = fa.get_sequences(regions, caps);
+            CHECK(got.size() == regions.size());
+            bool same = got.size() == regions.size();
+            for (std::size_t i = 0; same && i < regions.size(); i++) {
+                const auto& r = regions[i];
+                same = got[i] == fa.get_sequence(r.name, r.start, r.end, caps);
+            }
+            CHECK(same);
+        }
+        CHECK(fa.get_sequences(regions.data(), 0).empty());
+        regions.push_back({"chr1", 1, fa.find_record("chr1")->length + 1});
+        CHECK(throws([&] { fa.get_sequences(regions); }));
+        CHECK(throws([&] { fa.get_sequences(std::vector<FASTAFile::Region>{{"nope", 1, 1}}); }));
+    }
+}
+
+#ifdef FASTA_USE_ZLIB
+std::string gzip_file(const std::string& dir, const std::string& name, const std::string& content) {
+    std::string path = dir + "/" + name;
+    gzFile gz = gzopen(path.c_str(), "wb");
+    if (!gz || gzwrite(gz, content.data(), content.size()) != static_cast<int>(content.size()) || gzclose(gz) != Z_OK) {
+        throw std::runtime_error("Error writing " + path + "!");
+    }
+    created.push_back(path);
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+// a damaged .gz must throw, not read as a shorter file
+void test_gzip_errors(const std::string& dir) {
+    std::mt19937_64 rng(3);
+    std::string all;
+    std::string text = random_fasta(rng, 5, 60, all);
+    std::string gz = gzip_file(dir, "good.fa.gz", text);
+    std::string truncated = write_file(dir, "truncated.fa.gz", gz.substr(0, gz.size() * 9 / 10));
+    std::string damaged = gz;
+    for (std::size_t i = gz.size() / 3; i < gz.size() / 3 + 64; i++) damaged[i] ^= 0x55;
+    std::string corrupt = write_file(dir, "corrupt.fa.gz", damaged);
+
+    for (const auto& path : {truncated, corrupt}) {
+        CHECK(throws([&] {
+            for (auto& rec : FASTAReader(path)) (void)rec;
+        }));
+        CHECK(throws([&] { FASTAFile(path).build_index(); }));
+    }
+
+    std::size_t records = 0;
+    std::string bases;
+    for (auto& rec : FASTAReader(dir + "/good.fa.gz")) {
+        records++;
+        bases += rec.sequence;
+    }
+    CHECK(records == 5 && bases == all);
+    FASTAFile good(dir + "/good.fa.gz");
+    good.build_index();
+    CHECK(good.index().size() == 5);
+}
+#endif
+
+// packed records give back their original text, case, N runs and other
+// codes included, from any range
+void test_packed(const std::string& dir) {
+    std::mt19937_64 rng(16);
+    std::string seq = random_bytes(rng, 20000, "ACGTACGTacgtNNnRyk");
+    PackedSequence packed(seq);
+    CHECK(packed.size() == seq.size() && packed.packed().size() == (seq.size() + 3) / 4);
+    CHECK(packed.get_sequence(1, seq.size()) == seq);
+    std::string upper = seq;
+    for (auto& c : upper) c = fasta_detail::to_upper(c);
+    CHECK(packed.get_sequence(1, seq.size(), true) == upper);
+    for (int i = 0; i < 300; i++) {
+        std::size_t start = 1 + rng() % seq.size();
+        std::size_t end = start + rng() % std::min<std::size_t>(seq.size() - start + 1, 100);
+        CHECK(packed.get_sequence(start, end) == seq.substr(start - 1, end - start + 1));
+        CHECK(packed.base(start - 1) == seq[start - 1]);
+    }
+    for (const auto& b : packed.n_blocks()) {
+        CHECK(b.base == 'N' && upper.substr(b.start, b.length) == std::string(b.length, 'N'));
+    }
+    for (const auto& b : packed.mask_blocks()) CHECK(fasta_detail::is_lower(seq[b.start]));
+    CHECK(throws([&] { packed.get_sequence(0, 1); }));
+    CHECK(throws([&] { packed.get_sequence(1, seq.size() + 1); }));
+
+    // built from a file in blocks, or a piece at a time
+    std::string all;
+    FASTAFile fa(write_file(dir, "packed.fa", random_fasta(rng, 3, 60, all)));
+    fa.build_index();
+    PackedSequence pieces;
+    for (const auto& rec : fa.index()) {
+        std::string bases = fa.get_sequence(rec.name, 1, rec.length);
+        CHECK(PackedSequence(fa, rec.name).get_sequence(1, rec.length) == bases);
+        pieces.append(bases.data(), bases.size());
+    }
+    CHECK(pieces.get_sequence(1, all.size()) == all);
+}
+
+// .2bit files read back as written, and names have to be unique
+void test_twobit(const std::string& dir) {
+    std::mt19937_64 rng(7);
+    std::string all;
+    std::string path = write_file(dir, "twobit.fa", random_fasta(rng, 5, 60, all));
+    std::string out = dir + "/twobit.2bit";
+    created.push_back(out);
+    FASTAFile fa(path);
+    CHECK(TwoBitFile::write(fa, out));
+    TwoBitFile tb(out);
+    CHECK(tb.names().size() == 5);
+    for (const auto& rec : fa.index()) {
+        CHECK(tb.get_sequence(rec.name, 1, rec.length) == fa.get_sequence(rec.name, 1, rec.length));
+    }
+
+    std::string dup = write_file(dir, "dup.fa", ">a\nACGT\n>b\nGG\n>a\nTT\n");
+    FASTAFile twice(dup);
+    CHECK(throws([&] { TwoBitFile::write(twice, out); }));
+}
+
+// cached lookups return the same bases, count their blocks, and stay
+// within the byte budget
+void test_cache(const std::string& dir) {
+    std::mt19937_64 rng(13);
+    std::string seq = random_bytes(rng, 10000, "ACGTNacgt");
+    std::string text = ">c1\n";
+    for (std::size_t i = 0; i < seq.size(); i += 70) text += seq.substr(i, 70) + "\n";
+    FASTAFile fa(write_file(dir, "cache.fa", text));
+    std::string upper = seq;
+    for (auto& c : upper) c &= ~0x20;
+
+    fa.enable_cache(4 * 256, 256);
+    CHECK(fa.get_sequence("c1", 1, 100) == seq.substr(0, 100));
+    FASTAFile::CacheStats st = fa.cache_stats();
+    CHECK(st.hits == 0 && st.misses == 1 && st.blocks == 1 && st.bytes == 256);
+    CHECK(fa.get_sequence("c1", 50, 300, true) == upper.substr(49, 251));
+    st = fa.cache_stats();
+    CHECK(st.hits == 1 && st.misses == 2 && st.blocks == 2);
+
+    // the last block is short, and the budget holds four blocks
+    CHECK(fa.get_sequence("c1", 9990, 10000) == seq.substr(9989));
+    CHECK(fa.cache_stats().bytes == 2 * 256 + 10000 % 256);
+    for (int i = 0; i < 500; i++) {
+        std::size_t start = 1 + rng() % seq.size();
+        std::size_t end = start + rng() % std::min<std::size_t>(seq.size() - start + 1, 900);
+        CHECK(fa.get_sequence("c1", start, end) == seq.substr(start - 1, end - start + 1));
+    }
+    st = fa.cache_stats();
+    CHECK(st.bytes <= 4 * 256 && st.blocks <= 4 && st.hits > 0);
+
+    fa.disable_cache();
+    CHECK(fa.cache_stats().blocks == 0);
+    CHECK(fa.get_sequence("c1", 1, 10000) == seq);
+    CHECK(fa.cache_stats().blocks == 0);
+}
+
+// asynchronous lookups return what the blocking ones do, including ones
+// started by a callback, and close() waits for all of them
+void test_async(const std::string& dir) {
+    std::mt19937_64 rng(10);
+    std::string all;
+    FASTAFile fa(write_file(dir, "async.fa", random_fasta(rng, 8, 60, all)));
+    const auto& index = fa.index();
+    std::vector<std::future<std::string>> got;
+    std::vector<std::string> want;
+    for (int i = 0; i < 500; i++) {
+        const auto& rec = index[rng() % index.size()];
+        std::size_t start = 1 + rng() % rec.length;
+        std::size_t end = start + rng() % (rec.length - start + 1);
+        bool caps = i % 2;
+        got.push_back(fa.get_sequence_async(rec.name, start, end, caps));
+        want.push_back(fa.get_sequence(rec.name, start, end, caps));
+    }
+    for (std::size_t i = 0; i < got.size(); i++) CHECK(got[i].get() == want[i]);
+    CHECK(throws([&] { fa.get_sequence_async("chr1", 1, index[0].length + 1).get(); }));
+
+    // more chained lookups than an io_uring has room for
+    std::string first = fa.get_sequence(index[0].name, 1, 10);
+    std::atomic<int> left{4000};
+    std::atomic<int> wrong{0};
+    std::function<void(std::exception_ptr, std::string)> next = [&](std::exception_ptr err, std::string seq) {
+        if (err || seq != first) wrong++;
+        if (--left >= 0) fa.get_sequence_async(index[0].name, 1, 10, false, next);
+    };
+    for (int i = 0; i < 1000; i++) fa.get_sequence_async(index[0].name, 1, 10, false, next);
+    fa.close();
+    CHECK(left < 0 && wrong == 0);
+}
+
+// the reverse complement of ACGTN of either case, done the slow way
+std::string naive_revcomp(const std::string& s) {
+    std::string ret(s.rbegin(), s.rend());
+    for (auto& c : ret) {
+        char up = c & ~0x20;
+        char comp = up == 'A' ? 'T' : up == 'C' ? 'G' : up == 'G' ? 'C' : up == 'T' ? 'A' : up;
+        c = comp | (c & 0x20);
+    }
+    return ret;
+}
+
+// the reverse strand is the reverse complement of the forward one, on
+// every path a lookup can take
+void test_strands(const std::string& dir) {
+    std::mt19937_64 rng(16);
+    std::string seq = random_bytes(rng, 20000, "ACGTNacgtn");
+    std::string text = ">c1\n";
+    for (std::size_t i = 0; i < seq.size(); i += 60) text += seq.substr(i, 60) + "\n";
+    text += ">iupac\nACGTURYSWKMBVDHNacgtu-\n";
+    std::string path = write_file(dir, "strand.fa", text);
+    std::string upper = seq;
+    for (auto& c : upper) c &= ~0x20;
+
+    const auto rev = FASTAFile::Strand::Reverse;
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        for (int cached = 0; cached < 2; cached++) {
+            if (cached) fa.enable_cache(1 << 14, 512);
+            std::vector<FASTAFile::Region> regions;
+            std::vector<std::string> want;
+            for (int i = 0; i < 200; i++) {
+                std::size_t start = 1 + rng() % seq.size();
+                std::size_t end = start + rng() % std::min<std::size_t>(seq.size() - start + 1, 3000);
+                bool caps = i % 2;
+                std::string fwd = (caps ? upper : seq).substr(start - 1, end - start + 1);
+                CHECK(fa.get_sequence("c1", start, end, rev, caps) == naive_revcomp(fwd));
+                CHECK(fa.get_sequence("c1", start, end, FASTAFile::Strand::Forward, caps) == fwd);
+                std::string into;
+                CHECK(fa.get_sequence_into(into, "c1", start, end, rev, caps) == fwd.size());
+                CHECK(into == naive_revcomp(fwd));
+
+                auto strand = i % 3 ? rev : FASTAFile::Strand::Forward;
+                regions.push_back({"c1", start, end, strand});
+                fwd = seq.substr(start - 1, end - start + 1);
+                want.push_back(strand == rev ? naive_revcomp(fwd) : fwd);
+            }
+            CHECK(fa.get_sequences(regions) == want);
+        }
+        CHECK(fa.get_sequence("iupac", 1, 22, rev) == "-aacgtNDHBVKMWSRYAACGT");
+        CHECK(fa.get_sequence("iupac", 1, 22, rev, true) == "-AACGTNDHBVKMWSRYAACGT");
+    }
+
+    std::string mem = "ACGTNacgtnRY";
+    fasta_reverse_complement(&mem[0], mem.size());
+    CHECK(mem == "RYnacgtNACGT");
+    fasta_reverse_complement(&mem[0], mem.size(), true);
+    CHECK(mem == "ACGTNACGTNRY");
+
+    // a line ending inside an indexed line fails on the reverse strand too
+    std::string stray = write_file(dir, "stray-rev.fa", ">c1\nAC\rGT\nACGTA\nA\n");
+    write_file(dir, "stray-rev.fa.fai", "c1\t11\t4\t5\t6\n");
+    FASTAFile bad(stray);
+    CHECK(throws([&] { bad.get_sequence("c1", 1, 11, rev); }));
+    CHECK(bad.get_sequence("c1", 6, 11, rev) == "TTACGT");
+}
+
+// FASTQ records come back whole, wrapped or not, from a file or from memory,
+// and quality lines starting with '@' or '+' don't end them
+void test_fastq(const std::string& dir) {
+    std::mt19937_64 rng(17);
+    std::vector<FASTARecord> want(3000);
+    std::string text;
+    for (std::size_t r = 0; r < want.size(); r++) {
+        FASTARecord& w = want[r];
+        w.name = "read" + std::to_string(r);
+        w.description = r % 2 ? "len=" + std::to_string(r) : "";
+        w.sequence = random_bytes(rng, 1 + rng() % 300, "ACGTN");
+        w.quality = random_bytes(rng, w.sequence.size(), "@+!#5?IJ");
+        std::size_t width = r % 3 ? w.sequence.size() : 1 + rng() % 80;
+        text += "@" + w.name + (w.description.empty() ? "" : " " + w.description) + "\n";
+        for (std::size_t i = 0; i < w.sequence.size(); i += width) text += w.sequence.substr(i, width) + "\n";
+        text += r % 5 ? "+\n" : "+" + w.name + "\n";
+        for (std::size_t i = 0; i < w.quality.size(); i += width) text += w.quality.substr(i, width) + "\n";
+    }
+    std::string path = write_file(dir, "reads.fq", text);
+
+    auto same = [&](FASTAReader& reader) {
+        FASTARecord rec;
+        std::size_t n = 0;
+        bool ok = true;
+        while (reader.next(rec)) {
+            ok = ok && n < want.size() && rec.name == want[n].name && rec.description == want[n].description
+                && rec.sequence == want[n].sequence && rec.quality == want[n].quality;
+            n++;
+        }
+        return ok && n == want.size() && reader.fastq();
+    };
+    FASTAReader from_file(path);
+    CHECK(same(from_file));
+    FASTAReader from_memory(text.data(), text.size());
+    CHECK(same(from_memory));
+
+    // FASTA input has no quality
+    std::string fa = ">c1\nACGT\n>c2\nTT\n";
+    FASTAReader plain(fa.data(), fa.size());
+    FASTARecord rec;
+    CHECK(plain.next(rec) && rec.sequence == "ACGT" && rec.quality.empty() && !plain.fastq());
+
+    for (std::string bad : {"@r1\nACGT\n", "@r1\nACGT\n+\nII\n", "@r1\nACGT\n+\nIIIII\n@r2\nA\n+\nI\n"}) {
+        CHECK(throws([&] {
+            FASTAReader reader(bad.data(), bad.size());
+            FASTARecord r;
+            while (reader.next(r)) {}
+        }));
+    }
+}
+
+// gives some FASTA, then fails like a disk error
+class FailingStreambuf : public std::streambuf {
+    protected:
+        int_type underflow() override {
+            if (calls++) throw std::runtime_error("read error");
+            setg(text, text, text + std::strlen(text));
+            return traits_type::to_int_type(text[0]);
+        }
+
+    private:
+        char text[16] = ">a\nACGT\n>b\nAC";
+        int calls = 0;
+};
+
+// a stream that fails mid-read is an error, not the end of the input
+void test_stream_errors(const std::string&) {
+    FailingStreambuf sb;
+    std::istream in(&sb);
+    CHECK(throws([&] {
+        for (auto& rec : FASTAReader(in)) (void)rec;
+    }));
+
+    std::istringstream ok(">a\nACGT\n>b\nAC\n");
+    std::string bases;
+    for (auto& rec : FASTAReader(ok)) bases += rec.sequence;
+    CHECK(bases == "ACGTAC");
+}
+
+// the counters add up what the lookups did, and are all zero except the
+// cache's when built without FASTA_ENABLE_STATS
+void test_stats(const std::string& dir) {
+    std::mt19937_64 rng(20);
+    std::string seq = random_bytes(rng, 5000, "ACGT");
+    std::string text = ">c1\n";
+    for (std::size_t i = 0; i < seq.size(); i += 50) text += seq.substr(i, 50) + "\n";
+    FASTAFile fa(write_file(dir, "stats.fa", text));
+
+    std::vector<std::size_t> seen;
+    fa.set_latency_hook([&](std::uint64_t, std::size_t bases) { seen.push_back(bases); });
+    CHECK(fa.get_sequence("c1", 1, 100) == seq.substr(0, 100));
+    CHECK(fa.get_sequences({{"c1", 1, 10}, {"c1", 4001, 4020}, {"c1", 5, 6}}).size() == 3);
+    fa.enable_cache(1 << 16, 1024);
+    fa.get_sequence("c1", 1, 10);
+    fa.get_sequence("c1", 11, 20);
+
+    FASTAFile::Stats st = fa.stats();
+    CHECK(st.cache_hits == 1 && st.cache_misses == 1);
+#ifdef FASTA_ENABLE_STATS
+    CHECK(st.queries == 6);
+    CHECK(st.bases == 100 + 32 + 20);
+    CHECK(st.reads >= 3 && st.bytes_read >= 100 + 32 + 1024);
+    CHECK((seen == std::vector<std::size_t>{100, 32, 10, 10}));
+    fa.reset_stats();
+    st = fa.stats();
+    CHECK(st.queries == 0 && st.bases == 0 && st.bytes_read == 0 && st.reads == 0 && st.fetch_ns == 0);
+#else
+    CHECK(st.queries == 0 && st.bases == 0 && st.bytes_read == 0 && st.reads == 0 && st.fetch_ns == 0);
+    CHECK(seen.empty());
+#endif
+}
+
+// each policy bit does what it says, across the pieces the lookup is
+// translated in
+void test_policies(const std::string& dir) {
+    std::mt19937_64 rng(11);
+    std::string seq = random_bytes(rng, 150000, "ACGTNacgtn");
+    std::string text = ">big\n";
+    for (std::size_t i = 0; i < seq.size(); i += 61) text += seq.substr(i, 61) + "\n";
+    text += ">odd\nACGT-RYKMryk\n>protein\nMKV*\n";
+    FASTAFile fa(write_file(dir, "policy.fa", text));
+
+    std::string upper = seq, lower = seq, masked = seq, masked_lower = seq;
+    for (std::size_t i = 0; i < seq.size(); i++) {
+        bool soft = seq[i] >= 'a';
+        upper[i] = seq[i] & ~0x20;
+        lower[i] = seq[i] | 0x20;
+        masked[i] = soft ? 'N' : seq[i];
+        masked_lower[i] = soft ? 'n' : lower[i];
+    }
+    std::size_t n = seq.size();
+    CHECK(fa.get_sequence<FASTAPolicy::None>("big", 1, n) == seq);
+    CHECK(fa.get_sequence<FASTAPolicy::Upper>("big", 1, n) == upper);
+    CHECK(fa.get_sequence<FASTAPolicy::Lower>("big", 1, n) == lower);
+    CHECK(fa.get_sequence<FASTAPolicy::HardMask>("big", 1, n) == masked);
+    CHECK((fa.get_sequence<FASTAPolicy::HardMask | FASTAPolicy::Lower>("big", 1, n) == masked_lower));
+    CHECK(fa.get_sequence<FASTAPolicy::ReverseComplement>("big", 1, n) == naive_revcomp(seq));
+    CHECK((fa.get_sequence<FASTAPolicy::Upper | FASTAPolicy::ReverseComplement>("big", 70000, 140000)
+        == naive_revcomp(upper.substr(69999, 70001))));
+    CHECK(fa.get_sequence<FASTAPolicy::ValidateIUPAC>("big", 1, n) == seq);
+    std::string into;
+    CHECK(fa.get_sequence_into<FASTAPolicy::Upper>(into, "big", 5, 65600) == 65596 && into == upper.substr(4, 65596));
+
+    // '-' and the ambiguity codes (M, K and V among them) are IUPAC, while
+    // '*' isn't
+    CHECK(fa.get_sequence<FASTAPolicy::ValidateIUPAC>("odd", 1, 12) == "ACGT-RYKMryk");
+    CHECK((fa.get_sequence<FASTAPolicy::ValidateIUPAC | FASTAPolicy::Upper>("odd", 1, 12) == "ACGT-RYKMRYK"));
+    CHECK(fa.get_sequence<FASTAPolicy::ValidateIUPAC>("protein", 1, 3) == "MKV");
+    try {
+        fa.get_sequence<FASTAPolicy::ValidateIUPAC>("protein", 1, 4);
+        CHECK(false);
+    } catch (const std::runtime_error& e) {
+        CHECK(std::string(e.what()).find("'*' at position 4") != std::string::npos);
+    }
+    CHECK(throws([&] {
+        fa.get_sequence<FASTAPolicy::ValidateIUPAC | FASTAPolicy::ReverseComplement>("protein", 1, 4);
+    }));
+}
+
+// views read, slice, compare and iterate like the strings they stand for
+void test_sequence_view(const std::string& dir) {
+    std::mt19937_64 rng(12);
+    std::string all;
+    std::string path = write_file(dir, "view.fa", random_fasta(rng, 4, 60, all));
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        for (const auto& rec : fa.index()) {
+            std::string seq = fa.get_sequence(rec.name, 1, rec.length);
+            FASTAFile::SequenceView v = fa.view(rec.name);
+            CHECK(v.size() == seq.size() && v.name() == rec.name && v.start() == 1 && v.stop() == rec.length);
+            CHECK(v == seq && v.str() == seq && v.str(true) == fa.get_sequence(rec.name, 1, rec.length, true));
+            CHECK(std::string(v.begin(), v.end()) == seq);
+            for (int i = 0; i < 50; i++) {
+                std::size_t off = rng() % (seq.size() + 1);
+                std::size_t count = rng() % 700;
+                FASTAFile::SequenceView sub = v.substr(off, count);
+                std::string want = seq.substr(off, count);
+                CHECK(sub == want && sub.start() == off + 1);
+                if (!want.empty()) CHECK(sub[want.size() - 1] == want.back() && sub.at(0) == want[0]);
+                CHECK(throws<std::out_of_range>([&] { sub.at(want.size()); }));
+                std::string other = fa.get_sequence(rec.name, 1 + rng() % rec.length, rec.length).substr(0, count);
+                CHECK((sub.compare(other) < 0) == (want.compare(other) < 0));
+                CHECK((sub.compare(other) == 0) == (want == other));
+                CHECK((sub < fa.view(rec.name).substr(0, count)) == (want < seq.substr(0, count)));
+            }
+            CHECK(throws<std::out_of_range>([&] { v.substr(seq.size() + 1); }));
+        }
+        CHECK(throws([&] { fa.view("chr1", 1, fa.index()[0].length + 1); }));
+    }
+
+    FASTAFile::SequenceView none;
+    CHECK(none.empty() && none.name().empty() && none.begin() == none.end() && none == "");
+}
+
+// load_all() holds every record as a lookup would return it, found by
+// number or by name
+void test_load_all(const std::string& dir) {
+    std::mt19937_64 rng(23);
+    std::string all;
+    std::string path = write_file(dir, "all.fa", random_fasta(rng, 12, 70, all));
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        for (unsigned threads : {1u, 4u}) {
+            for (bool caps : {false, true}) {
+                FASTASequences seqs = fa.load_all(caps, threads);
+                CHECK(seqs.size() == 12 && seqs.bytes() > all.size());
+                bool same = seqs.size() == 12;
+                for (std::size_t i = 0; same && i < seqs.size(); i++) {
+                    std::string name = "chr" + std::to_string(i + 1);
+                    std::string want = fa.get_sequence(name, 1, fa.find_record(name)->length, caps);
+                    same = seqs.name(i) == name && seqs.sequence(i) == want && seqs.find(name) == i
+                        && seqs.sequence(name) == want;
+                }
+                CHECK(same);
+                CHECK(seqs.find("chr13") == FASTASequences::npos);
+                CHECK(throws([&] { seqs.sequence("chr0"); }));
+            }
+        }
+    }
+    FASTASequences none;
+    CHECK(none.empty() && none.bytes() == 0 && none.find("chr1") == FASTASequences::npos);
+}
+
+#ifdef FASTA_HAVE_POSIX
+// a shared store answers lookups like the file it was made from, and
+// outlives its name
+void test_shared(const std::string& dir) {
+    std::mt19937_64 rng(24);
+    std::string all;
+    FASTAFile fa(write_file(dir, "shared.fa", random_fasta(rng, 5, 60, all)));
+    std::string name = "/fasta-test-" + std::to_string(getpid());
+    FASTAFile::unlink_shared(name);
+    CHECK(fa.share(name));
+    CHECK(!fa.share(name));
+
+    FASTAFile store;
+    CHECK(!store.open_shared(name + "-missing"));
+    CHECK(store.open_shared(name) && store.is_shared() && !fa.is_shared());
+    CHECK(store.index().size() == 5);
+    for (int i = 0; i < 200; i++) {
+        std::string rec = "chr" + std::to_string(1 + rng() % 5);
+        std::size_t len = fa.find_record(rec)->length;
+        std::size_t start = 1 + rng() % len;
+        std::size_t end = start + rng() % (len - start + 1);
+        bool caps = i % 2;
+        CHECK(store.get_sequence(rec, start, end, caps) == fa.get_sequence(rec, start, end, caps));
+        CHECK(store.get_sequence(rec, start, end, FASTAFile::Strand::Reverse)
+            == fa.get_sequence(rec, start, end, FASTAFile::Strand::Reverse));
+    }
+    CHECK(store.get_sequence(1, all.size()) == all);
+    CHECK(throws([&] { store.records(); }));
+
+    CHECK(FASTAFile::unlink_shared(name));
+    CHECK(!FASTAFile::unlink_shared(name));
+    FASTAFile gone;
+    CHECK(!gone.open_shared(name));
+    CHECK(store.get_sequence("chr1", 1, 10) == fa.get_sequence("chr1", 1, 10));
+}
+#endif
+
+// sliding windows, overlapping or not, match plain lookups however small
+// the readahead, and going back rereads
+void test_cursor(const std::string& dir) {
+    std::mt19937_64 rng(13);
+    std::string all;
+    FASTAFile fa(write_file(dir, "cursor.fa", random_fasta(rng, 3, 60, all)));
+    for (const auto& rec : fa.index()) {
+        std::string seq = fa.get_sequence(rec.name, 1, rec.length);
+        for (std::size_t ahead : {1, 100, 1 << 20}) {
+            FASTAFile::Cursor c = fa.cursor(rec.name, ahead);
+            CHECK(c.name() == rec.name && c.length() == rec.length);
+            std::size_t window = 1 + rng() % 200;
+            std::size_t step = 1 + rng() % (2 * window);
+            std::string got;
+            std::size_t start = 1;
+            for (; c.next_window(got, window, step, ahead == 100); start += step) {
+                std::string want = seq.substr(start - 1, window);
+                if (ahead == 100) want = fa.get_sequence(rec.name, start, start + window - 1, true);
+                CHECK(got == want);
+            }
+            CHECK(start - 1 + window > rec.length);
+            CHECK(c.get_sequence(1, 10) == seq.substr(0, 10));
+            CHECK(throws([&] { c.get_sequence(1, rec.length + 1); }));
+            CHECK(throws([&] { c.next_window(got, 0, 1); }));
+        }
+    }
+
+    FASTAFile::Cursor none;
+    std::string out;
+    CHECK(none.name().empty() && none.length() == 0 && !none.next_window(out, 1, 1));
+    CHECK(throws([&] { none.get_sequence(1, 1); }));
+}
+
+// the counting kernels agree with the scalar one, including on long runs
+// that overflow the byte-wide counters of the vector kernels
+void test_count_kernels(const std::string&) {
+    std::mt19937_64 rng(8);
+    auto count = KERNELS(count_bases);
+    for (int round = 0; round < 2000; round++) {
+        std::size_t n = rng() % 300;
+        std::size_t skew = rng() % 32;
+        const char* alphabet = round % 2 ? "ACGTacgtN\n" : "ACGTNRYacgtn\r\n*-@";
+        std::string src = std::string(skew, 'x') + random_bytes(rng, n, alphabet);
+        const char* p = src.data() + skew;
+        std::uint64_t want[fasta_detail::COUNT_KINDS] = {};
+        fasta_detail::count_bases_scalar(p, n, want);
+        for (auto fn : count) {
+            std::uint64_t got[fasta_detail::COUNT_KINDS] = {};
+            fn(p, n, got);
+            CHECK(std::equal(got, got + fasta_detail::COUNT_KINDS, want));
+        }
+    }
+
+    std::string big = random_bytes(rng, 1 << 20, "AAAAAAAAcgtN");
+    std::uint64_t want[fasta_detail::COUNT_KINDS] = {};
+    fasta_detail::count_bases_scalar(big.data(), big.size(), want);
+    for (auto fn : count) {
+        std::uint64_t got[fasta_detail::COUNT_KINDS] = {};
+        fn(big.data(), big.size(), got);
+        CHECK(std::equal(got, got + fasta_detail::COUNT_KINDS, want));
+    }
+}
+
+// counts the bases of s the slow way
+FASTAFile::Composition naive_composition(const std::string& s) {
+    FASTAFile::Composition c;
+    for (char b : s) {
+        char up = b & ~0x20;
+        if (up == 'A') c.a++;
+        else if (up == 'C') c.c++;
+        else if (up == 'G') c.g++;
+        else if (up == 'T') c.t++;
+        else if (up == 'N') c.n++;
+        else c.other++;
+        if (b >= 'a' && b <= 'z') c.lower++;
+        c.length++;
+    }
+    return c;
+}
+
+bool same_composition(const FASTAFile::Composition& x, const FASTAFile::Composition& y) {
+    return x.a == y.a && x.c == y.c && x.g == y.g && x.t == y.t && x.n == y.n && x.other == y.other
+        && x.lower == y.lower && x.length == y.length;
+}
+
+// composition() matches a plain count on both backends, with and without
+// the prefix index
+void test_composition(const std::string& dir) {
+    std::mt19937_64 rng(26);
+    std::string seq = random_bytes(rng, 50000, "ACGTNacgtnRYk");
+    std::string text = ">c1\n";
+    for (std::size_t i = 0; i < seq.size(); i += 77) text += seq.substr(i, 77) + "\n";
+    text += ">c2\nGGCCAT\n";
+    std::string path = write_file(dir, "comp.fa", text);
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        for (int indexed = 0; indexed < 3; indexed++) {
+            if (indexed == 1) fa.build_composition_index(1000, 1);
+            if (indexed == 2) fa.build_composition_index(64, 4);
+            bool same = true;
+            for (int i = 0; i < 300; i++) {
+                std::size_t start = 1 + rng() % seq.size();
+                std::size_t end = start + rng() % (seq.size() - start + 1);
+                same = same && same_composition(fa.composition("c1", start, end),
+                    naive_composition(seq.substr(start - 1, end - start + 1)));
+            }
+            CHECK(same);
+            CHECK(same_composition(fa.composition("c1"), naive_composition(seq)));
+        }
+        fa.drop_composition_index();
+        CHECK(same_composition(fa.composition("c1", 1, 1), naive_composition(seq.substr(0, 1))));
+
+        FASTAFile::Composition c2 = fa.composition("c2");
+        CHECK(c2.gc_fraction() == 4.0 / 6 && c2.n_fraction() == 0 && c2.masked_fraction() == 0);
+        CHECK(throws([&] { fa.composition("c2", 1, 7); }));
+        CHECK(throws([&] { fa.composition("c3"); }));
+    }
+}
+
+#ifdef FASTA_USE_ZLIB
+// BGZF written by FASTAWriter reads back through its .fai and .gzi
+void test_bgzf(const std::string& dir) {
+    std::mt19937_64 rng(4);
+    std::string all;
+    std::string plain = write_file(dir, "plain.fa", random_fasta(rng, 40, 70, all));
+    std::string path = dir + "/bgzf.fa.gz";
+    created.push_back(path);
+    created.push_back(path + ".gzi");
+
+    FASTAFile src(plain);
+    FASTAWriter out(path, 70, FASTAWriter::Compression::Bgzf, 2);
+    for (const auto& rec : src.index()) out.write(rec.name, src.get_sequence(rec.name, 1, rec.length));
+    CHECK(out.close());
+
+    FASTAFile fa(path);
+    CHECK(fa.compression() == FASTAWriter::Compression::Bgzf && fa.has_index());
+    for (int i = 0; i < 300; i++) {
+        const auto& rec = src.index()[rng() % src.index().size()];
+        std::size_t start = 1 + rng() % rec.length;
+        std::size_t end = start + rng() % (rec.length - start + 1);
+        CHECK(fa.get_sequence(rec.name, start, end) == src.get_sequence(rec.name, start, end));
+    }
+    std::string bases;
+    for (auto& rec : FASTAReader(path)) bases += rec.sequence;
+    CHECK(bases == all);
+}
+#endif
+
+// slots filled out of order from several threads come out in slot order,
+// with a .fai matching one built from the output
+void test_writer(const std::string& dir) {
+    std::mt19937_64 rng(15);
+    std::vector<std::string> seqs;
+    for (int i = 0; i < 200; i++) seqs.push_back(random_bytes(rng, rng() % 60000, "ACGTacgtN"));
+    std::string want;
+    for (std::size_t i = 0; i < seqs.size(); i++) {
+        want += ">r" + std::to_string(i) + (i % 3 ? "" : " some text") + "\n";
+        for (std::size_t j = 0; j < seqs[i].size(); j += 70) want += seqs[i].substr(j, 70) + "\n";
+    }
+
+    std::string path = dir + "/written.fa";
+    created.push_back(path);
+    FASTAWriter out(path, 70);
+    std::vector<std::size_t> order(seqs.size());
+    for (std::size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    std::atomic<std::size_t> next{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (std::size_t i; (i = next++) < order.size();) {
+                std::size_t slot = order[i];
+                out.write(slot, "r" + std::to_string(slot), seqs[slot], slot % 3 ? "" : "some text");
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    // a header that wouldn't read back is refused before it takes a slot
+    CHECK(throws<std::invalid_argument>([&] { out.write("two\nlines", "ACGT"); }));
+    CHECK(throws<std::invalid_argument>([&] { out.write(">named", "ACGT"); }));
+    CHECK(throws<std::invalid_argument>([&] { out.write("", "ACGT"); }));
+    CHECK(throws<std::invalid_argument>([&] { out.write(seqs.size(), "ok", "ACGT", "cr\r"); }));
+    CHECK(out.close());
+
+    std::ifstream in(path, std::ios::binary);
+    CHECK(std::string(std::istreambuf_iterator<char>(in), {}) == want);
+    FASTAFile fa(path);
+    std::vector<FASTAIndexEntry> written = fa.index();
+    fa.build_index();
+    CHECK(written.size() == seqs.size() && fa.index().size() == seqs.size());
+    for (std::size_t i = 0; i < written.size() && i < fa.index().size(); i++) {
+        const auto& a = written[i];
+        const auto& b = fa.index()[i];
+        CHECK(a.name == b.name && a.length == b.length && a.offset == b.offset);
+        CHECK(a.line_bases == b.line_bases && a.line_width == b.line_width);
+    }
+    CHECK(seqs[199].empty() || fa.get_sequence("r199", 1, seqs[199].size()) == seqs[199]);
+
+    // a slot left empty loses what comes after it
+    FASTAWriter gap(path, 0);
+    gap.write(0, "a", "ACGT");
+    gap.write(2, "c", "GG");
+    CHECK(!gap.close());
+}
+
+// the k-mers of bases[0, n) that hold only A, C, G and T, of either case,
+// worked out one at a time
+std::vector<FASTAFile::Kmer> naive_kmers(const std::string& bases, unsigned k, std::size_t first_pos) {
+    std::vector<FASTAFile::Kmer> ret;
+    auto code = [](char c) -> int {
+        switch (c | 0x20) {
+            case 'a': return 0;
+            case 'c': return 1;
+            case 'g': return 2;
+            case 't': return 3;
+            default: return -1;
+        }
+    };
+    for (std::size_t i = 0; i + k <= bases.size(); i++) {
+        FASTAFile::Kmer km;
+        bool ok = true;
+        for (unsigned j = 0; j < k && ok; j++) {
+            int f = code(bases[i + j]);
+            int r = code(bases[i + k - 1 - j]);
+            ok = f >= 0 && r >= 0;
+            km.forward = km.forward << 2 | f;
+            km.reverse = km.reverse << 2 | (3 - r);
+        }
+        km.pos = first_pos + i;
+        if (ok) ret.push_back(km);
+    }
+    return ret;
+}
+
+// k-mers on both strands match the naive ones, skipping any with an N in
+// them, one at a time or in batches, on either backend
+void test_kmers(const std::string& dir) {
+    std::mt19937_64 rng(14);
+    std::string all;
+    std::string path = write_file(dir, "kmers.fa", random_fasta(rng, 3, 60, all));
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile fa(path, backend);
+        for (const auto& rec : fa.index()) {
+            for (unsigned k : {1u, 5u, 21u, 31u, 32u}) {
+                std::size_t start = 1 + rng() % rec.length;
+                std::size_t end = start + rng() % (rec.length - start + 1);
+                std::vector<FASTAFile::Kmer> want = naive_kmers(fa.get_sequence(rec.name, start, end), k, start);
+
+                FASTAFile::KmerReader reader = fa.kmers(rec.name, start, end, k);
+                CHECK(reader.k() == k && reader.name() == rec.name);
+                FASTAFile::Kmer km;
+                std::size_t i = 0;
+                for (; reader.next(km); i++) {
+                    if (i >= want.size()) break;
+                    CHECK(km.forward == want[i].forward && km.reverse == want[i].reverse && km.pos == want[i].pos);
+                    CHECK(km.canonical() == std::min(want[i].forward, want[i].reverse));
+                }
+                CHECK(i == want.size());
+
+                for (bool canonical : {false, true}) {
+                    FASTAFile::KmerReader batches = fa.kmers(rec.name, start, end, k);
+                    std::vector<std::uint64_t> words(7);
+                    std::vector<std::size_t> pos(7);
+                    std::size_t got = 0, n;
+                    bool same = true;
+                    while ((n = batches.next_batch(words.data(), words.size(), pos.data(), canonical)) > 0) {
+                        for (std::size_t j = 0; j < n && same; j++) {
+                            same = got + j < want.size() && pos[j] == want[got + j].pos
+                                && words[j] == (canonical ? want[got + j].canonical() : want[got + j].forward);
+                        }
+                        got += n;
+                        if (got > want.size()) break;
+                    }
+                    CHECK(same && got == want.size());
+                }
+            }
+        }
+        CHECK(throws([&] { fa.kmers("chr1", 0); }));
+        CHECK(throws([&] { fa.kmers("chr1", 33); }));
+    }
+
+    FASTAFile::KmerReader none;
+    FASTAFile::Kmer km;
+    CHECK(none.name().empty() && !none.next(km));
+}
+
+// the validation kernels class bytes like the scalar one
+void test_classify_kernels(const std::string&) {
+    std::mt19937_64 rng(9);
+    auto classify = KERNELS(classify);
+    for (int round = 0; round < 2000; round++) {
+        std::size_t n = rng() % 300;
+        std::size_t skew = rng() % 32;
+        const char* alphabet = round % 3 == 0 ? "ACGTacgtN\n" : round % 3 == 1 ? "ACGTNRYacgtn\r\n*-@" : "ACGU";
+        std::string src = std::string(skew, 'x') + random_bytes(rng, n, alphabet);
+        const char* p = src.data() + skew;
+        fasta_detail::ByteClasses a;
+        fasta_detail::classify_scalar(p, n, a);
+        for (auto fn : classify) {
+            fasta_detail::ByteClasses b;
+            fn(p, n, b);
+            CHECK(a.mask == b.mask && a.newlines == b.newlines && a.returns == b.returns);
+        }
+    }
+}
+
+// validate() finds each record's alphabet, case and line endings, and
+// catches a \r that would shift the bases, as does building an index
+void test_validate(const std::string& dir) {
+    std::string path = write_file(dir, "alphabets.fa", ">dna\nACGTN\nacgt\n>rna\nACGU\n>iupac\nACGT-RY\n"
+        ">protein\nMKV*\n>bad\nAC@T\n");
+    FASTAFile fa(path);
+    CHECK(!fa.validate());
+    const FASTAAlphabet want[] = {FASTAAlphabet::DNA, FASTAAlphabet::RNA, FASTAAlphabet::IUPAC,
+        FASTAAlphabet::Protein, FASTAAlphabet::Invalid};
+    for (std::size_t i = 0; i < 5; i++) CHECK(fa.index()[i].alphabet == want[i] && !fa.index()[i].crlf);
+    CHECK(fa.index()[0].soft_masked && !fa.index()[1].soft_masked);
+
+    std::string crlf = write_file(dir, "crlf2.fa", ">c1\r\nACGTA\r\nACGTA\r\nA\r\n>c2\r\nTT\r\n");
+    FASTAFile ok(crlf);
+    CHECK(ok.index()[0].alphabet == FASTAAlphabet::Unchecked);
+    CHECK(ok.validate(2) && ok.index()[0].crlf && ok.index()[1].crlf);
+    CHECK(ok.get_sequence("c1", 4, 8) == "TAACG");
+
+    std::string stray = write_file(dir, "stray3.fa", ">c1\nAC\rGT\nACGTA\nA\n");
+    write_file(dir, "stray3.fa.fai", "c1\t11\t4\t5\t6\n");
+    for (auto backend : {FASTAFile::Backend::Stream, FASTAFile::Backend::Mmap}) {
+        FASTAFile f(stray, backend);
+        CHECK(throws([&] { f.validate(); }));
+    }
+
+    std::string data = ">c1\nACGTA\nAC\rGT\nA\n";
+    FASTAFile unindexed(write_file(dir, "stray4.fa", data));
+    CHECK(throws([&] { unindexed.build_index(); }));
+    CHECK(throws([&] { FASTAIndexBuilder::index(data.data(), data.size(), 4); }));
+}
+
+// counts the reads that reach a source
+class CountingSource : public FASTAByteSource {
+    public:
+        explicit CountingSource(std::string bytes): data_(std::move(bytes)) {}
+
+        std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const override {
+            reads++;
+            if (offset >= data_.size()) return 0;
+            n = std::min<std::uint64_t>(n, data_.size() - offset);
+            std::memcpy(dst, data_.data() + offset, n);
+            return n;
+        }
+        std::uint64_t size() const override { return data_.size(); }
+        std::string name() const override { return "test data"; }
+
+        mutable std::atomic<std::size_t> reads{0};
+
+    private:
+        std::string data_;
+};
+
+// a file read through the block cache gives the same bases as from disk,
+// with missing blocks fetched together and sweeps read ahead
+void test_cached_source(const std::string& dir) {
+    std::mt19937_64 rng(5);
+    std::string all;
+    std::string text = random_fasta(rng, 8, 60, all);
+    std::string path = write_file(dir, "cached.fa", text);
+    FASTAFile local(path);
+
+    auto inner = std::make_shared<CountingSource>(text);
+    auto cached = std::make_shared<FASTACachedSource>(inner, 1 << 20, 1024);
+    char buf[8192];
+    CHECK(cached->read_at(100, buf, sizeof(buf)) == sizeof(buf) && inner->reads == 1);
+    CHECK(std::memcmp(buf, text.data() + 100, sizeof(buf)) == 0);
+    CHECK(cached->read_at(200, buf, 4000) == 4000 && inner->reads == 1);
+    CHECK(cached->read_at(text.size() - 10, buf, 100) == 10);
+
+    FASTAFile fa(cached);
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong(0);
+    for (unsigned t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 r(t);
+            for (int i = 0; i < 200; i++) {
+                const auto& rec = local.index()[r() % local.index().size()];
+                std::size_t start = 1 + r() % rec.length;
+                std::size_t end = start + r() % (rec.length - start + 1);
+                if (fa.get_sequence(rec.name, start, end) != local.get_sequence(rec.name, start, end)) wrong++;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    CHECK(wrong == 0);
+
+    // reads that carry on from each other bring in several blocks at once
+    auto sweep_inner = std::make_shared<CountingSource>(text);
+    FASTACachedSource sweep(sweep_inner, 1 << 20, 1024, 8);
+    for (std::uint64_t at = 0; at < text.size(); at += 512) sweep.read_at(at, buf, 512);
+    std::size_t blocks = (text.size() + 1023) / 1024;
+    CHECK(sweep_inner->reads * 4 <= blocks);
+}
+
+#ifdef FASTA_HAVE_POSIX
+// serves files over HTTP range requests on a loopback port, one thread per
+// connection, counting the requests
+class TestServer {
+    public:
+        explicit TestServer(std::map<std::string, std::string> files): files(std::move(files)) {
+            listener = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+                    || listen(listener, 16) != 0
+                    || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+                throw std::runtime_error("Error starting the test server");
+            }
+            port = ntohs(addr.sin_port);
+            acceptor = std::thread([this] {
+                int c;
+                while ((c = accept(listener, nullptr, nullptr)) >= 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    connections.emplace_back([this, c] { serve(c); });
+                }
+            });
+        }
+
+        ~TestServer() {
+            shutdown(listener, SHUT_RDWR);
+            ::close(listener);
+            acceptor.join();
+            for (auto& t : connections) t.join();
+        }
+
+        std::string url(const std::string& file) const {
+            return "http://127.0.0.1:" + std::to_string(port) + "/" + file;
+        }
+
+        std::atomic<std::size_t> requests{0};
+
+        // ways to answer wrongly, for checking the client notices
+        enum Fault { None, WrongStart, NoLength, IndexFails };
+        std::atomic<int> fault{None};
+
+    private:
+        std::map<std::string, std::string> files;
+        int listener = -1;
+        int port = 0;
+        std::thread acceptor;
+        std::mutex mutex;
+        std::vector<std::thread> connections;
+
+        void serve(int c) {
+            std::string in;
+            char buf[4096];
+            for (;;) {
+                std::size_t end;
+                while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+                    ssize_t k = ::recv(c, buf, sizeof(buf), 0);
+                    if (k <= 0) {
+                        ::close(c);
+                        return;
+                    }
+                    in.append(buf, k);
+                }
+                std::string head = in.substr(0, end);
+                in.erase(0, end + 4);
+                requests++;
+
+                std::string path = head.substr(5, head.find(' ', 5) - 5);
+                auto it = files.find(path);
+                std::string reply;
+                if (fault == IndexFails && path.size() > 4 && path.compare(path.size() - 4, 4, ".fai") == 0) {
+                    reply = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+                } else if (it == files.end()) {
+                    reply = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+                } else {
+                    const std::string& body = it->second;
+                    std::size_t range = head.find("Range: bytes=");
+                    std::uint64_t first = std::strtoull(head.c_str() + range + 13, nullptr, 10);
+                    std::uint64_t last = std::strtoull(head.c_str() + head.find('-', range + 13) + 1, nullptr, 10);
+                    if (first >= body.size()) {
+                        reply = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */"
+                            + std::to_string(body.size()) + "\r\nContent-Length: 0\r\n\r\n";
+                    } else {
+                        last = std::min<std::uint64_t>(last, body.size() - 1);
+                        std::uint64_t said = fault == WrongStart ? first + 1 : first;
+                        reply = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(said) + "-"
+                            + std::to_string(last) + "/" + std::to_string(body.size()) + "\r\n";
+                        reply += fault == NoLength ? std::string("Connection: close\r\n")
+                            : "Content-Length: " + std::to_string(last - first + 1) + "\r\n";
+                        reply += "\r\n" + body.substr(first, last - first + 1);
+                    }
+                }
+                for (std::size_t at = 0; at < reply.size();) {
+                    ssize_t k = ::send(c, reply.data() + at, reply.size() - at, MSG_NOSIGNAL);
+                    if (k <= 0) break;
+                    at += k;
+                }
+            }
+        }
+};
+
+// a file over HTTP reads like the local one, taking its .fai from the
+// server, with nearby lookups sharing requests
+void test_http_source(const std::string& dir) {
+    std::mt19937_64 rng(6);
+    std::string all;
+    std::string text = random_fasta(rng, 6, 60, all);
+    std::string path = write_file(dir, "remote.fa", text);
+    FASTAFile local(path);
+    local.build_index();
+    CHECK(local.write_index(path + ".fai"));
+    std::ifstream fai(path + ".fai", std::ios::binary);
+    TestServer server({{"remote.fa", text}, {"remote.fa.fai", std::string(std::istreambuf_iterator<char>(fai), {})}});
+
+    FASTAFile fa;
+    CHECK(fa.open_url(server.url("remote.fa")));
+    CHECK(fa.has_index() && fa.index().size() == local.index().size());
+    for (int i = 0; i < 300; i++) {
+        const auto& rec = local.index()[rng() % local.index().size()];
+        std::size_t start = 1 + rng() % rec.length;
+        std::size_t end = start + rng() % (rec.length - start + 1);
+        CHECK(fa.get_sequence(rec.name, start, end) == local.get_sequence(rec.name, start, end));
+    }
+
+    std::size_t before = server.requests;
+    std::vector<FASTAFile::Region> regions;
+    for (std::size_t i = 0; i < 100; i++) regions.push_back({"chr1", 1 + i * 10, 5 + i * 10});
+    FASTAFile fresh;
+    CHECK(fresh.open_url(server.url("remote.fa")));
+    before = server.requests;
+    std::vector<std::string> got = fresh.get_sequences(regions);
+    CHECK(server.requests - before <= 2);
+    CHECK(got.size() == regions.size() && got[7] == local.get_sequence("chr1", 71, 75));
+
+    CHECK(throws([&] { FASTAHttpSource(server.url("missing.fa")); }));
+    CHECK(throws([&] { FASTAHttpSource("https://127.0.0.1/remote.fa"); }));
+
+    // a missing .fai is built from the data, but a failing one is an error
+    TestServer bare({{"remote.fa", text}});
+    FASTAFile unindexed;
+    CHECK(unindexed.open_url(bare.url("remote.fa")));
+    CHECK(unindexed.get_sequence("chr2", 1, 20) == local.get_sequence("chr2", 1, 20));
+    server.fault = TestServer::IndexFails;
+    CHECK(throws([&] { FASTAFile f; f.open_url(server.url("remote.fa")); }));
+
+    // a body that isn't the range asked for
+    server.fault = TestServer::WrongStart;
+    CHECK(throws([&] { FASTAHttpSource(server.url("remote.fa")); }));
+    server.fault = TestServer::NoLength;
+    CHECK(throws([&] { FASTAHttpSource(server.url("remote.fa")); }));
+}
+#endif
+
+struct Test {
+    const char* name;
+    void (*run)(const std::string& dir);
+};
+
+const Test tests[] = {
+    {"malformed index", test_malformed_index},
+    {"global coordinates", test_global_coordinates},
+    {"strip kernels", test_strip_kernels},
+    {"line endings", test_line_endings},
+    {"batched lookups", test_batched},
+#ifdef FASTA_USE_ZLIB
+    {"gzip errors", test_gzip_errors},
+#endif
+    {"packed sequence", test_packed},
+    {"2bit", test_twobit},
+    {"block cache", test_cache},
+    {"async", test_async},
+    {"strands", test_strands},
+    {"fastq", test_fastq},
+    {"stream errors", test_stream_errors},
+    {"stats", test_stats},
+    {"policies", test_policies},
+    {"sequence view", test_sequence_view},
+    {"load all", test_load_all},
+#ifdef FASTA_HAVE_POSIX
+    {"shared store", test_shared},
+#endif
+    {"cursor", test_cursor},
+    {"count kernels", test_count_kernels},
+    {"composition", test_composition},
+#ifdef FASTA_USE_ZLIB
+    {"bgzf", test_bgzf},
+#endif
+    {"writer", test_writer},
+    {"k-mers", test_kmers},
+    {"classify kernels", test_classify_kernels},
+    {"validate", test_validate},
+    {"cached source", test_cached_source},
+#ifdef FASTA_HAVE_POSIX
+    {"http source", test_http_source},
+#endif
+};
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    std::string dir = "/tmp";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-d" && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [-d DIR]\n";
+            return 2;
+        }
+    }
+
+    for (const auto& t : tests) {
+        int before = failures;
+        try {
+            t.run(dir);
+        } catch (const std::exception& e) {
+            std::printf("  unexpected exception: %s\n", e.what());
+            failures++;
+        }
+        std::printf("%-24s %s\n", t.name, failures == before ? "ok" : "FAILED");
+    }
+
+    for (const auto& path : created) {
+        std::remove(path.c_str());
+        std::remove((path + ".fai").c_str());
+    }
+    if (failures) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
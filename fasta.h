@@ -28,88 +28,5546 @@
 
 #include <fstream>
 #include <string>
+#include <sstream>
 #include <cstring>
+#include <cerrno>
+#include <limits>
 #include <stdexcept>
 #include <iostream>
 #include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <memory>
+#include <iterator>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <chrono>
+#include <array>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <new>
+
+#ifdef FASTA_USE_ZLIB
+#include <zlib.h>
+#endif
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#define FASTA_HAVE_SPAN 1
+#include <span>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FASTA_HAVE_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define FASTA_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define FASTA_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// size of the blocks read when scanning a whole file
+#define FASTA_BLOCK_SIZE (4 << 20)
+
+// batched lookups merge reads separated by at most this many bytes
+#define FASTA_COALESCE_GAP 4096
+
+// number of inflated BGZF blocks kept per file
+#define FASTA_BGZF_CACHE_BLOCKS 64
+
+// bytes of records a FASTAWriter holds while an earlier slot is missing
+#define FASTA_WRITER_QUEUE_BYTES (256 << 20)
+
+// bytes a FASTAWriter gathers, in page-aligned memory, before each write
+#define FASTA_WRITER_BUFFER_BYTES (4 << 20)
 
 // check if a char is EOF
 #define IS_EOF(c) ((c) == std::ifstream::traits_type::eof())
 
-class FASTAFile {
-    public:
-        FASTAFile(): file("") {}
-        FASTAFile(const std::string& filename): file(filename) {
-            if (!open(filename)) {
-                throw std::runtime_error("Error opening file: " + filename + "!");
+// the smallest alphabet holding every base of a record, of either case
+enum class FASTAAlphabet : std::uint8_t {
+    Unchecked, // not validated yet
+    DNA,       // A, C, G, T and N
+    RNA,       // A, C, G, U and N
+    IUPAC,     // any IUPAC nucleotide code, and '-'
+    Protein,   // any letter, '*' and '-'
+    Invalid,   // anything else
+};
+
+// one line of a samtools-compatible .fai index
+struct FASTAIndexEntry {
+    std::string name;
+    std::size_t length = 0;     // number of bases in the record
+    std::uint64_t offset = 0;   // byte offset of the first base
+    std::size_t line_bases = 0; // bases per line
+    std::size_t line_width = 0; // bytes per line, including the line ending
+
+    // set by FASTAFile::validate(), which also checks that the lines are
+    // laid out as above. these aren't part of the .fai format, so they are
+    // Unchecked in every index that is loaded or built until validate()
+    // runs in this process.
+    FASTAAlphabet alphabet = FASTAAlphabet::Unchecked;
+    bool soft_masked = false; // some bases are lowercase
+    bool crlf = false;        // lines end in \r\n
+
+    // byte offset of the 0-based position pos within this record
+    std::uint64_t byte_offset(std::size_t pos) const {
+        return offset + (pos / line_bases) * line_width + pos % line_bases;
+    }
+};
+
+namespace fasta_detail {
+
+    inline bool is_lower(char c) {
+        return static_cast<unsigned char>(c - 'a') < 26;
+    }
+
+    inline std::size_t strip_copy_scalar(char* dst, const char* src, std::size_t n, bool caps) {
+        char* out = dst;
+        for (std::size_t i = 0; i < n; i++) {
+            char c = src[i];
+            if (c == '\n' || c == '\r') continue;
+            if (caps && is_lower(c)) c -= 'a' - 'A';
+            *out++ = c;
+        }
+        return out - dst;
+    }
+
+    // the vector kernels copy whole blocks that hold no line endings and
+    // hand the rest to the scalar kernel. out never passes src + i, so the
+    // copy can be done in place.
+#if defined(__SSE2__) || defined(_M_X64)
+    inline std::size_t strip_copy_sse2(char* dst, const char* src, std::size_t n, bool caps) {
+        const __m128i nl = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lo = _mm_set1_epi8('a' - 1);
+        const __m128i hi = _mm_set1_epi8('z' + 1);
+        const __m128i bit = _mm_set1_epi8(0x20);
+        char* out = dst;
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i ends = _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr));
+            if (_mm_movemask_epi8(ends)) {
+                out += strip_copy_scalar(out, src + i, 16, caps);
+                continue;
+            }
+            if (caps) {
+                __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+                v = _mm_xor_si128(v, _mm_and_si128(lower, bit));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+            out += 16;
+        }
+        return (out - dst) + strip_copy_scalar(out, src + i, n - i, caps);
+    }
+#endif
+
+#ifdef FASTA_HAVE_AVX2
+    __attribute__((target("avx2")))
+    inline std::size_t strip_copy_avx2(char* dst, const char* src, std::size_t n, bool caps) {
+        const __m256i nl = _mm256_set1_epi8('\n');
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lo = _mm256_set1_epi8('a' - 1);
+        const __m256i hi = _mm256_set1_epi8('z' + 1);
+        const __m256i bit = _mm256_set1_epi8(0x20);
+        char* out = dst;
+        std::size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i ends = _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr));
+            if (_mm256_movemask_epi8(ends)) {
+                out += strip_copy_scalar(out, src + i, 32, caps);
+                continue;
+            }
+            if (caps) {
+                __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+                v = _mm256_xor_si256(v, _mm256_and_si256(lower, bit));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+            out += 32;
+        }
+        return (out - dst) + strip_copy_sse2(out, src + i, n - i, caps);
+    }
+#endif
+
+#if defined(__aarch64__)
+    inline std::size_t strip_copy_neon(char* dst, const char* src, std::size_t n, bool caps) {
+        const uint8x16_t nl = vdupq_n_u8('\n');
+        const uint8x16_t cr = vdupq_n_u8('\r');
+        const uint8x16_t lo = vdupq_n_u8('a');
+        const uint8x16_t hi = vdupq_n_u8('z');
+        const uint8x16_t bit = vdupq_n_u8(0x20);
+        char* out = dst;
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t v = vld1q_u8(reinterpret_cast<const std::uint8_t*>(src + i));
+            uint8x16_t ends = vorrq_u8(vceqq_u8(v, nl), vceqq_u8(v, cr));
+            if (vmaxvq_u8(ends)) {
+                out += strip_copy_scalar(out, src + i, 16, caps);
+                continue;
+            }
+            if (caps) {
+                uint8x16_t lower = vandq_u8(vcgeq_u8(v, lo), vcleq_u8(v, hi));
+                v = veorq_u8(v, vandq_u8(lower, bit));
+            }
+            vst1q_u8(reinterpret_cast<std::uint8_t*>(out), v);
+            out += 16;
+        }
+        return (out - dst) + strip_copy_scalar(out, src + i, n - i, caps);
+    }
+#endif
+
+    using strip_copy_fn = std::size_t (*)(char*, const char*, std::size_t, bool);
+
+    // picks the widest kernel the running CPU supports
+    inline strip_copy_fn pick_strip_copy() {
+#if defined(FASTA_NO_SIMD)
+        return strip_copy_scalar;
+#elif defined(__aarch64__)
+        return strip_copy_neon;
+#elif defined(__SSE2__) || defined(_M_X64)
+#ifdef FASTA_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2")) return strip_copy_avx2;
+#endif
+        return strip_copy_sse2;
+#else
+        return strip_copy_scalar;
+#endif
+    }
+
+    // base counts in the order the counting kernels keep them
+    enum { COUNT_A, COUNT_C, COUNT_G, COUNT_T, COUNT_N, COUNT_LOWER, COUNT_KINDS };
+
+    // adds the A, C, G, T and N bytes of any case, and the lowercase
+    // letters, among the n bytes at p to counts
+    inline void count_bases_scalar(const char* p, std::size_t n, std::uint64_t* counts) {
+        for (std::size_t i = 0; i < n; i++) {
+            char c = p[i];
+            switch (c | 0x20) {
+                case 'a': counts[COUNT_A]++; break;
+                case 'c': counts[COUNT_C]++; break;
+                case 'g': counts[COUNT_G]++; break;
+                case 't': counts[COUNT_T]++; break;
+                case 'n': counts[COUNT_N]++; break;
+            }
+            counts[COUNT_LOWER] += is_lower(c);
+        }
+    }
+
+    // the vector kernels keep one byte-wide counter per lane and kind,
+    // which are summed before they can wrap after 255 blocks
+#if defined(__SSE2__) || defined(_M_X64)
+    inline void count_bases_sse2(const char* p, std::size_t n, std::uint64_t* counts) {
+        const __m128i bit = _mm_set1_epi8(0x20);
+        const __m128i a = _mm_set1_epi8('a');
+        const __m128i letters = _mm_set1_epi8(25);
+        const __m128i want[5] = {a, _mm_set1_epi8('c'), _mm_set1_epi8('g'), _mm_set1_epi8('t'),
+            _mm_set1_epi8('n')};
+        const __m128i zero = _mm_setzero_si128();
+        std::size_t i = 0;
+        while (i + 16 <= n) {
+            __m128i acc[COUNT_KINDS];
+            for (auto& x : acc) x = zero;
+            std::size_t stop = i + 16 * std::min<std::size_t>(255, (n - i) / 16);
+            for (; i < stop; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                __m128i folded = _mm_or_si128(v, bit);
+                for (int k = 0; k < 5; k++) acc[k] = _mm_sub_epi8(acc[k], _mm_cmpeq_epi8(folded, want[k]));
+                __m128i off = _mm_sub_epi8(v, a);
+                acc[COUNT_LOWER] = _mm_sub_epi8(acc[COUNT_LOWER], _mm_cmpeq_epi8(_mm_min_epu8(off, letters), off));
+            }
+            for (int k = 0; k < COUNT_KINDS; k++) {
+                __m128i sum = _mm_sad_epu8(acc[k], zero);
+                counts[k] += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+            }
+        }
+        count_bases_scalar(p + i, n - i, counts);
+    }
+#endif
+
+#ifdef FASTA_HAVE_AVX2
+    __attribute__((target("avx2")))
+    inline void count_bases_avx2(const char* p, std::size_t n, std::uint64_t* counts) {
+        const __m256i bit = _mm256_set1_epi8(0x20);
+        const __m256i a = _mm256_set1_epi8('a');
+        const __m256i letters = _mm256_set1_epi8(25);
+        const __m256i want[5] = {a, _mm256_set1_epi8('c'), _mm256_set1_epi8('g'), _mm256_set1_epi8('t'),
+            _mm256_set1_epi8('n')};
+        const __m256i zero = _mm256_setzero_si256();
+        std::size_t i = 0;
+        while (i + 32 <= n) {
+            __m256i acc[COUNT_KINDS];
+            for (auto& x : acc) x = zero;
+            std::size_t stop = i + 32 * std::min<std::size_t>(255, (n - i) / 32);
+            for (; i < stop; i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+                __m256i folded = _mm256_or_si256(v, bit);
+                for (int k = 0; k < 5; k++) acc[k] = _mm256_sub_epi8(acc[k], _mm256_cmpeq_epi8(folded, want[k]));
+                __m256i off = _mm256_sub_epi8(v, a);
+                acc[COUNT_LOWER] = _mm256_sub_epi8(acc[COUNT_LOWER],
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(off, letters), off));
+            }
+            for (int k = 0; k < COUNT_KINDS; k++) {
+                __m256i sum = _mm256_sad_epu8(acc[k], zero);
+                counts[k] += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+                    + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+            }
+        }
+        count_bases_sse2(p + i, n - i, counts);
+    }
+#endif
+
+#if defined(__aarch64__)
+    inline void count_bases_neon(const char* p, std::size_t n, std::uint64_t* counts) {
+        const uint8x16_t bit = vdupq_n_u8(0x20);
+        const uint8x16_t a = vdupq_n_u8('a');
+        const uint8x16_t letters = vdupq_n_u8(25);
+        const uint8x16_t one = vdupq_n_u8(1);
+        const uint8x16_t want[5] = {a, vdupq_n_u8('c'), vdupq_n_u8('g'), vdupq_n_u8('t'), vdupq_n_u8('n')};
+        std::size_t i = 0;
+        while (i + 16 <= n) {
+            uint8x16_t acc[COUNT_KINDS];
+            for (auto& x : acc) x = vdupq_n_u8(0);
+            std::size_t stop = i + 16 * std::min<std::size_t>(255, (n - i) / 16);
+            for (; i < stop; i += 16) {
+                uint8x16_t v = vld1q_u8(reinterpret_cast<const std::uint8_t*>(p + i));
+                uint8x16_t folded = vorrq_u8(v, bit);
+                for (int k = 0; k < 5; k++) acc[k] = vaddq_u8(acc[k], vandq_u8(vceqq_u8(folded, want[k]), one));
+                acc[COUNT_LOWER] = vaddq_u8(acc[COUNT_LOWER], vandq_u8(vcleq_u8(vsubq_u8(v, a), letters), one));
+            }
+            for (int k = 0; k < COUNT_KINDS; k++) counts[k] += vaddlvq_u8(acc[k]);
+        }
+        count_bases_scalar(p + i, n - i, counts);
+    }
+#endif
+
+    using count_bases_fn = void (*)(const char*, std::size_t, std::uint64_t*);
+
+    inline count_bases_fn pick_count_bases() {
+#if defined(FASTA_NO_SIMD)
+        return count_bases_scalar;
+#elif defined(__aarch64__)
+        return count_bases_neon;
+#elif defined(__SSE2__) || defined(_M_X64)
+#ifdef FASTA_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2")) return count_bases_avx2;
+#endif
+        return count_bases_sse2;
+#else
+        return count_bases_scalar;
+#endif
+    }
+
+    inline void count_bases(const char* p, std::size_t n, std::uint64_t* counts) {
+        static const count_bases_fn fn = pick_count_bases();
+        fn(p, n, counts);
+    }
+
+    // IUPAC nucleotide codes of either case, and '-' for a gap
+    constexpr bool is_iupac(unsigned char c) {
+        if (c == '-') return true;
+        switch (c | 0x20) {
+            case 'a': case 'c': case 'g': case 't': case 'u': case 'r': case 'y': case 's':
+            case 'w': case 'k': case 'm': case 'b': case 'd': case 'h': case 'v': case 'n':
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // classes of bytes found by the validation kernels. line endings are
+    // counted rather than classed.
+    enum : std::uint8_t {
+        CLASS_ACG = 1,
+        CLASS_T = 2,
+        CLASS_U = 4,
+        CLASS_N = 8,
+        CLASS_IUPAC = 16,   // other nucleotide codes and '-'
+        CLASS_PROTEIN = 32, // other letters and '*'
+        CLASS_LOWER = 64,
+        CLASS_INVALID = 128,
+    };
+
+    constexpr std::array<std::uint8_t, 256> make_class_table() {
+        std::array<std::uint8_t, 256> t{};
+        for (unsigned c = 0; c < 256; c++) {
+            std::uint8_t v = 0;
+            switch (c | 0x20) {
+                case 'a': case 'c': case 'g': v = CLASS_ACG; break;
+                case 't': v = CLASS_T; break;
+                case 'u': v = CLASS_U; break;
+                case 'n': v = CLASS_N; break;
+                default:
+                    v = is_iupac(c) ? CLASS_IUPAC
+                        : (c | 0x20) >= 'a' && (c | 0x20) <= 'z' ? CLASS_PROTEIN : CLASS_INVALID;
+            }
+            if (c == '*') v = CLASS_PROTEIN;
+            if (c == '\n' || c == '\r') v = 0;
+            if (c >= 'a' && c <= 'z') v |= CLASS_LOWER;
+            t[c] = v;
+        }
+        return t;
+    }
+
+    inline constexpr std::array<std::uint8_t, 256> class_table = make_class_table();
+
+    // what the validation kernels found in some bytes
+    struct ByteClasses {
+        std::uint8_t mask = 0; // CLASS_ bits of every byte seen
+        std::uint64_t newlines = 0;
+        std::uint64_t returns = 0;
+    };
+
+    inline void classify_scalar(const char* p, std::size_t n, ByteClasses& out) {
+        std::uint8_t mask = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            unsigned char c = p[i];
+            mask |= class_table[c];
+            out.newlines += c == '\n';
+            out.returns += c == '\r';
+        }
+        out.mask |= mask;
+    }
+
+    // the vector kernels take blocks of nothing but ACGTN and line endings
+    // whole, which is what most files hold, and pass any other block to the
+    // scalar kernel
+#if defined(__SSE2__) || defined(_M_X64)
+    inline void classify_sse2(const char* p, std::size_t n, ByteClasses& out) {
+        const __m128i bit = _mm_set1_epi8(0x20);
+        const __m128i a = _mm_set1_epi8('a');
+        const __m128i c = _mm_set1_epi8('c');
+        const __m128i g = _mm_set1_epi8('g');
+        const __m128i t = _mm_set1_epi8('t');
+        const __m128i nn = _mm_set1_epi8('n');
+        const __m128i nl = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i zero = _mm_setzero_si128();
+        __m128i seen_acg = zero, seen_t = zero, seen_n = zero, seen_case = zero;
+        std::size_t i = 0;
+        while (i + 16 <= n) {
+            __m128i nl_count = zero, cr_count = zero;
+            std::size_t stop = i + 16 * std::min<std::size_t>(255, (n - i) / 16);
+            for (; i < stop; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                __m128i folded = _mm_or_si128(v, bit);
+                __m128i is_acg = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, a), _mm_cmpeq_epi8(folded, c)),
+                    _mm_cmpeq_epi8(folded, g));
+                __m128i is_t = _mm_cmpeq_epi8(folded, t);
+                __m128i is_n = _mm_cmpeq_epi8(folded, nn);
+                __m128i is_nl = _mm_cmpeq_epi8(v, nl);
+                __m128i is_cr = _mm_cmpeq_epi8(v, cr);
+                __m128i known = _mm_or_si128(_mm_or_si128(is_acg, is_t), _mm_or_si128(is_n, _mm_or_si128(is_nl, is_cr)));
+                if (_mm_movemask_epi8(known) != 0xffff) {
+                    classify_scalar(p + i, 16, out);
+                    continue;
+                }
+                seen_acg = _mm_or_si128(seen_acg, is_acg);
+                seen_t = _mm_or_si128(seen_t, is_t);
+                seen_n = _mm_or_si128(seen_n, is_n);
+                // of these bytes only lowercase letters have 0x20 set
+                seen_case = _mm_or_si128(seen_case, v);
+                nl_count = _mm_sub_epi8(nl_count, is_nl);
+                cr_count = _mm_sub_epi8(cr_count, is_cr);
+            }
+            __m128i sum = _mm_sad_epu8(nl_count, zero);
+            out.newlines += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+            sum = _mm_sad_epu8(cr_count, zero);
+            out.returns += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        }
+        if (_mm_movemask_epi8(seen_acg)) out.mask |= CLASS_ACG;
+        if (_mm_movemask_epi8(seen_t)) out.mask |= CLASS_T;
+        if (_mm_movemask_epi8(seen_n)) out.mask |= CLASS_N;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(seen_case, bit), bit))) out.mask |= CLASS_LOWER;
+        classify_scalar(p + i, n - i, out);
+    }
+#endif
+
+#ifdef FASTA_HAVE_AVX2
+    __attribute__((target("avx2")))
+    inline void classify_avx2(const char* p, std::size_t n, ByteClasses& out) {
+        const __m256i bit = _mm256_set1_epi8(0x20);
+        const __m256i a = _mm256_set1_epi8('a');
+        const __m256i c = _mm256_set1_epi8('c');
+        const __m256i g = _mm256_set1_epi8('g');
+        const __m256i t = _mm256_set1_epi8('t');
+        const __m256i nn = _mm256_set1_epi8('n');
+        const __m256i nl = _mm256_set1_epi8('\n');
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i seen_acg = zero, seen_t = zero, seen_n = zero, seen_case = zero;
+        std::size_t i = 0;
+        while (i + 32 <= n) {
+            __m256i nl_count = zero, cr_count = zero;
+            std::size_t stop = i + 32 * std::min<std::size_t>(255, (n - i) / 32);
+            for (; i < stop; i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+                __m256i folded = _mm256_or_si256(v, bit);
+                __m256i is_acg = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, a),
+                    _mm256_cmpeq_epi8(folded, c)), _mm256_cmpeq_epi8(folded, g));
+                __m256i is_t = _mm256_cmpeq_epi8(folded, t);
+                __m256i is_n = _mm256_cmpeq_epi8(folded, nn);
+                __m256i is_nl = _mm256_cmpeq_epi8(v, nl);
+                __m256i is_cr = _mm256_cmpeq_epi8(v, cr);
+                __m256i known = _mm256_or_si256(_mm256_or_si256(is_acg, is_t),
+                    _mm256_or_si256(is_n, _mm256_or_si256(is_nl, is_cr)));
+                if (_mm256_movemask_epi8(known) != -1) {
+                    classify_scalar(p + i, 32, out);
+                    continue;
+                }
+                seen_acg = _mm256_or_si256(seen_acg, is_acg);
+                seen_t = _mm256_or_si256(seen_t, is_t);
+                seen_n = _mm256_or_si256(seen_n, is_n);
+                seen_case = _mm256_or_si256(seen_case, v);
+                nl_count = _mm256_sub_epi8(nl_count, is_nl);
+                cr_count = _mm256_sub_epi8(cr_count, is_cr);
+            }
+            __m256i sum = _mm256_sad_epu8(nl_count, zero);
+            out.newlines += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+                + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+            sum = _mm256_sad_epu8(cr_count, zero);
+            out.returns += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+                + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+        }
+        if (_mm256_movemask_epi8(seen_acg)) out.mask |= CLASS_ACG;
+        if (_mm256_movemask_epi8(seen_t)) out.mask |= CLASS_T;
+        if (_mm256_movemask_epi8(seen_n)) out.mask |= CLASS_N;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(seen_case, bit), bit))) out.mask |= CLASS_LOWER;
+        classify_sse2(p + i, n - i, out);
+    }
+#endif
+
+#if defined(__aarch64__)
+    inline void classify_neon(const char* p, std::size_t n, ByteClasses& out) {
+        const uint8x16_t bit = vdupq_n_u8(0x20);
+        const uint8x16_t one = vdupq_n_u8(1);
+        const uint8x16_t a = vdupq_n_u8('a');
+        const uint8x16_t c = vdupq_n_u8('c');
+        const uint8x16_t g = vdupq_n_u8('g');
+        const uint8x16_t t = vdupq_n_u8('t');
+        const uint8x16_t nn = vdupq_n_u8('n');
+        const uint8x16_t nl = vdupq_n_u8('\n');
+        const uint8x16_t cr = vdupq_n_u8('\r');
+        uint8x16_t seen_acg = vdupq_n_u8(0), seen_t = seen_acg, seen_n = seen_acg, seen_case = seen_acg;
+        std::size_t i = 0;
+        while (i + 16 <= n) {
+            uint8x16_t nl_count = vdupq_n_u8(0), cr_count = nl_count;
+            std::size_t stop = i + 16 * std::min<std::size_t>(255, (n - i) / 16);
+            for (; i < stop; i += 16) {
+                uint8x16_t v = vld1q_u8(reinterpret_cast<const std::uint8_t*>(p + i));
+                uint8x16_t folded = vorrq_u8(v, bit);
+                uint8x16_t is_acg = vorrq_u8(vorrq_u8(vceqq_u8(folded, a), vceqq_u8(folded, c)), vceqq_u8(folded, g));
+                uint8x16_t is_t = vceqq_u8(folded, t);
+                uint8x16_t is_n = vceqq_u8(folded, nn);
+                uint8x16_t is_nl = vceqq_u8(v, nl);
+                uint8x16_t is_cr = vceqq_u8(v, cr);
+                uint8x16_t known = vorrq_u8(vorrq_u8(is_acg, is_t), vorrq_u8(is_n, vorrq_u8(is_nl, is_cr)));
+                if (vminvq_u8(known) == 0) {
+                    classify_scalar(p + i, 16, out);
+                    continue;
+                }
+                seen_acg = vorrq_u8(seen_acg, is_acg);
+                seen_t = vorrq_u8(seen_t, is_t);
+                seen_n = vorrq_u8(seen_n, is_n);
+                seen_case = vorrq_u8(seen_case, v);
+                nl_count = vaddq_u8(nl_count, vandq_u8(is_nl, one));
+                cr_count = vaddq_u8(cr_count, vandq_u8(is_cr, one));
+            }
+            out.newlines += vaddlvq_u8(nl_count);
+            out.returns += vaddlvq_u8(cr_count);
+        }
+        if (vmaxvq_u8(seen_acg)) out.mask |= CLASS_ACG;
+        if (vmaxvq_u8(seen_t)) out.mask |= CLASS_T;
+        if (vmaxvq_u8(seen_n)) out.mask |= CLASS_N;
+        if (vmaxvq_u8(vandq_u8(seen_case, bit))) out.mask |= CLASS_LOWER;
+        classify_scalar(p + i, n - i, out);
+    }
+#endif
+
+    using classify_fn = void (*)(const char*, std::size_t, ByteClasses&);
+
+    inline classify_fn pick_classify() {
+#if defined(FASTA_NO_SIMD)
+        return classify_scalar;
+#elif defined(__aarch64__)
+        return classify_neon;
+#elif defined(__SSE2__) || defined(_M_X64)
+#ifdef FASTA_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2")) return classify_avx2;
+#endif
+        return classify_sse2;
+#else
+        return classify_scalar;
+#endif
+    }
+
+    inline void classify(const char* p, std::size_t n, ByteClasses& out) {
+        static const classify_fn fn = pick_classify();
+        fn(p, n, out);
+    }
+
+    // the smallest alphabet holding every class in mask
+    inline FASTAAlphabet alphabet_of(std::uint8_t mask) {
+        std::uint8_t m = mask & ~CLASS_LOWER;
+        if (m & CLASS_INVALID) return FASTAAlphabet::Invalid;
+        if (!(m & ~(CLASS_ACG | CLASS_T | CLASS_N))) return FASTAAlphabet::DNA;
+        if (!(m & ~(CLASS_ACG | CLASS_U | CLASS_N))) return FASTAAlphabet::RNA;
+        if (!(m & ~(CLASS_ACG | CLASS_T | CLASS_U | CLASS_N | CLASS_IUPAC))) return FASTAAlphabet::IUPAC;
+        return FASTAAlphabet::Protein;
+    }
+
+    // ASCII case changes, which unlike std::toupper don't depend on the
+    // locale
+    inline char to_upper(char c) {
+        return is_lower(c) ? c - ('a' - 'A') : c;
+    }
+
+    inline char to_lower(char c) {
+        return static_cast<unsigned char>(c - 'A') < 26 ? c + ('a' - 'A') : c;
+    }
+
+    // 2-bit codes, as in UCSC .2bit, or -1 for anything but ACGT
+    inline int base_code(char c) {
+        switch (c) {
+            case 'T': case 't': return 0;
+            case 'C': case 'c': return 1;
+            case 'A': case 'a': return 2;
+            case 'G': case 'g': return 3;
+            default: return -1;
+        }
+    }
+
+    // the four bases held in each possible packed byte
+    inline const char (&unpack_table())[256][4] {
+        static const struct Table {
+            char bases[256][4];
+            Table() {
+                for (int b = 0; b < 256; b++) {
+                    for (int i = 0; i < 4; i++) bases[b][i] = "TCAG"[(b >> (6 - 2 * i)) & 3];
+                }
+            }
+        } table;
+        return table.bases;
+    }
+
+    // writes the n bases packed in bits from the 0-based position pos on
+    inline void unpack_bases(const std::uint8_t* bits, std::size_t pos, std::size_t n, char* out) {
+        static const char letters[] = "TCAG";
+        const auto& table = unpack_table();
+        std::size_t stop = pos + n;
+        for (; pos < stop && pos % 4; pos++) *out++ = letters[(bits[pos / 4] >> (6 - 2 * (pos % 4))) & 3];
+        for (; pos + 4 <= stop; pos += 4, out += 4) std::memcpy(out, table[bits[pos / 4]], 4);
+        for (; pos < stop; pos++) *out++ = letters[(bits[pos / 4] >> (6 - 2 * (pos % 4))) & 3];
+    }
+
+    // complements of the IUPAC codes, keeping case, or also uppercasing if
+    // caps is set. other bytes are left alone.
+    inline const char* complement_table(bool caps) {
+        static const struct Table {
+            char keep[256];
+            char upper[256];
+            Table() {
+                const char* from = "ACGTURYSWKMBVDHN";
+                const char* to = "TGCAAYRSWMKVBHDN";
+                for (int c = 0; c < 256; c++) {
+                    keep[c] = c;
+                    upper[c] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+                }
+                for (int i = 0; from[i]; i++) {
+                    keep[static_cast<unsigned char>(from[i])] = to[i];
+                    keep[from[i] + 32] = to[i] + 32;
+                    upper[static_cast<unsigned char>(from[i])] = to[i];
+                    upper[from[i] + 32] = to[i];
+                }
+            }
+        } table;
+        return caps ? table.upper : table.keep;
+    }
+
+    // writes the complements of the n bytes at src backwards, ending just
+    // before dst_end
+    inline void reverse_complement_copy(char* dst_end, const char* src, std::size_t n, const char* table) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(src);
+        for (; n >= 4; n -= 4, p += 4) {
+            dst_end -= 4;
+            dst_end[3] = table[p[0]];
+            dst_end[2] = table[p[1]];
+            dst_end[1] = table[p[2]];
+            dst_end[0] = table[p[3]];
+        }
+        for (; n > 0; n--) *--dst_end = table[*p++];
+    }
+
+    // the number of threads to use when 0 means "one per core"
+    inline unsigned thread_count(unsigned threads) {
+        return threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // calls fn(i) for every i below count on up to threads threads, which
+    // take the next i from a shared counter as they finish. the first
+    // exception thrown stops the handing out and is rethrown.
+    template <class F>
+    void parallel_for(unsigned threads, std::size_t count, F fn) {
+        std::atomic<std::size_t> next(0);
+        std::atomic<bool> failed(false);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto work = [&] {
+            for (std::size_t i; !failed.load(std::memory_order_relaxed)
+                    && (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                    failed = true;
+                }
+            }
+        };
+
+        threads = std::min<std::size_t>(thread_count(threads), std::max<std::size_t>(count, 1));
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; t++) pool.emplace_back(work);
+        work();
+        for (auto& t : pool) t.join();
+        if (error) std::rethrow_exception(error);
+    }
+
+} /* namespace fasta_detail */
+
+// copies n bytes from src to dst, dropping '\n' and '\r', and uppercases
+// a-z if caps is set. dst may be the same as src. returns the number of
+// bytes written, which dst must have room for.
+inline std::size_t fasta_strip_copy(char* dst, const char* src, std::size_t n, bool caps = false) {
+    static const fasta_detail::strip_copy_fn kernel = fasta_detail::pick_strip_copy();
+    return kernel(dst, src, n, caps);
+}
+
+// reverse-complements n bases in place, keeping IUPAC codes and case, and
+// uppercases them too if caps is set
+inline void fasta_reverse_complement(char* s, std::size_t n, bool caps = false) {
+    const char* table = fasta_detail::complement_table(caps);
+    char* a = s;
+    char* b = s + n;
+    while (a < b) {
+        char c = table[static_cast<unsigned char>(*--b)];
+        *b = table[static_cast<unsigned char>(*a)];
+        *a++ = c;
+    }
+}
+
+// options for the templated lookups, such as
+//     fa.get_sequence<FASTAPolicy::Upper | FASTAPolicy::ValidateIUPAC>("chr1", 1, 100)
+// each combination gets its own translation loop, built at compile time.
+struct FASTAPolicy {
+    enum : unsigned {
+        None = 0,
+        Upper = 1,              // uppercase every base
+        Lower = 2,              // lowercase every base
+        HardMask = 4,           // turn soft-masked (lowercase) bases into N
+        ValidateIUPAC = 8,      // throw on anything but IUPAC nucleotide codes and '-'
+        ReverseComplement = 16, // the reverse strand, complemented
+    };
+};
+
+namespace fasta_detail {
+
+    // what each byte becomes under a policy, or 0 if it fails validation.
+    // complements are done while copying, so they aren't part of this.
+    template <unsigned Policy>
+    struct PolicyTable {
+        static_assert(!((Policy & FASTAPolicy::Upper) && (Policy & FASTAPolicy::Lower)),
+            "Upper and Lower can't be combined");
+
+        static constexpr std::array<char, 256> make() {
+            std::array<char, 256> t{};
+            for (unsigned c = 0; c < 256; c++) {
+                bool lower = c >= 'a' && c <= 'z';
+                bool upper = c >= 'A' && c <= 'Z';
+                unsigned v = c;
+                if ((Policy & FASTAPolicy::ValidateIUPAC) && !is_iupac(c)) {
+                    v = 0;
+                } else if ((Policy & FASTAPolicy::HardMask) && lower) {
+                    v = (Policy & FASTAPolicy::Lower) ? 'n' : 'N';
+                } else if ((Policy & FASTAPolicy::Upper) && lower) {
+                    v = c - 32;
+                } else if ((Policy & FASTAPolicy::Lower) && upper) {
+                    v = c + 32;
+                }
+                t[c] = static_cast<char>(v);
+            }
+            return t;
+        }
+
+        static constexpr std::array<char, 256> table = make();
+
+        // true if the policy changes or checks any bytes
+        static constexpr bool active = (Policy & ~unsigned(FASTAPolicy::ReverseComplement)) != 0;
+    };
+
+    // translates n bytes in place. with ValidateIUPAC, returns the index
+    // of the first byte that failed, or n if none did.
+    template <unsigned Policy>
+    std::size_t apply_policy(char* p, std::size_t n) {
+        const auto& t = PolicyTable<Policy>::table;
+        unsigned char bad = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            char c = t[static_cast<unsigned char>(p[i])];
+            p[i] = c;
+            if (Policy & FASTAPolicy::ValidateIUPAC) bad |= c == 0;
+        }
+        if (!bad) return n;
+        return std::find(p, p + n, '\0') - p;
+    }
+
+    // k-mer codes A=0, C=1, G=2, T=3 of either case, so that numeric order
+    // is lexicographic order and a base's complement is 3 - code. line
+    // endings are skipped, and anything else breaks the k-mer.
+    enum : unsigned char { KMER_SKIP = 4, KMER_BREAK = 5 };
+
+    constexpr std::array<unsigned char, 256> make_kmer_table() {
+        std::array<unsigned char, 256> t{};
+        for (unsigned c = 0; c < 256; c++) {
+            switch (c | 0x20) {
+                case 'a': t[c] = 0; break;
+                case 'c': t[c] = 1; break;
+                case 'g': t[c] = 2; break;
+                case 't': t[c] = 3; break;
+                default: t[c] = c == '\n' || c == '\r' ? KMER_SKIP : KMER_BREAK;
+            }
+        }
+        return t;
+    }
+
+    inline constexpr std::array<unsigned char, 256> kmer_table = make_kmer_table();
+
+} /* namespace fasta_detail */
+
+// builds .fai entries from FASTA data fed to it in arbitrary blocks.
+// throws a std::runtime_error if a record's line widths are inconsistent,
+// or if a sequence line holds a \r anywhere but just before its \n, since
+// either would make arithmetic offsets wrong.
+class FASTAIndexBuilder {
+    public:
+        // feeds the next n bytes of the file
+        void feed(const char* data, std::size_t n) {
+            const char* p = data;
+            const char* end = data + n;
+            // most files have no \r at all, and skip the check per line
+            bool returns = n > 0 && std::memchr(data, '\r', n);
+            while (p < end) {
+                if (line_start) {
+                    line_start = false;
+                    line_len = 0;
+                    if (*p == '>') {
+                        finish_record();
+                        in_header = true;
+                        name.clear();
+                        name_done = false;
+                        p++;
+                        pos++;
+                        continue;
+                    }
+                }
+
+                const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                const char* seg_end = nl ? nl : end;
+                if (in_header) {
+                    for (const char* c = p; !name_done && c < seg_end; c++) {
+                        if (std::isspace(static_cast<unsigned char>(*c))) {
+                            name_done = true;
+                        } else {
+                            name += *c;
+                        }
+                    }
+                } else if (seg_end > p) {
+                    if (last == '\r' && line_len > 0) stray_return();
+                    if (returns) {
+                        const char* r = static_cast<const char*>(std::memchr(p, '\r', seg_end - p));
+                        if (r && r != seg_end - 1) stray_return();
+                    }
+                    line_len += seg_end - p;
+                    last = seg_end[-1];
+                }
+                pos += seg_end - p;
+                p = seg_end;
+
+                if (nl) {
+                    p++;
+                    pos++;
+                    end_line(true);
+                    line_start = true;
+                }
+            }
+        }
+
+        // finishes the last record and returns the index entries
+        std::vector<FASTAIndexEntry> finish() {
+            if (!line_start) end_line(false);
+            finish_record();
+            line_start = true;
+            return std::move(entries);
+        }
+
+        // indexes n bytes of FASTA in memory on threads threads (0 for one
+        // per core). record starts are found in separate chunks at once, then
+        // each record's lines are checked in pieces against its first line.
+        // anything irregular is left to a plain single-threaded pass, so the
+        // result and errors are the same as feeding the whole buffer.
+        static std::vector<FASTAIndexEntry> index(const char* data, std::size_t n, unsigned threads = 0) {
+            std::vector<FASTAIndexEntry> entries;
+            if (fasta_detail::thread_count(threads) > 1 && n > 0 && data[0] == '>'
+                    && index_parallel(data, n, threads, entries, std::memchr(data, '\r', n) != nullptr)) {
+                return entries;
+            }
+            FASTAIndexBuilder builder;
+            builder.feed(data, n);
+            return builder.finish();
+        }
+
+    private:
+        std::vector<FASTAIndexEntry> entries;
+        FASTAIndexEntry cur;
+        bool have_record = false;
+        bool in_header = false;
+        bool name_done = false;
+        bool line_start = true;
+        bool ended = false; // a short line has been seen in this record
+        std::string name;
+        std::uint64_t pos = 0; // bytes consumed so far
+        std::size_t line_len = 0;
+        std::size_t lineno = 0;
+        char last = 0;
+
+        void end_line(bool newline) {
+            lineno++;
+            if (in_header) {
+                in_header = false;
+                have_record = true;
+                ended = false;
+                cur = FASTAIndexEntry();
+                cur.name = name;
+                cur.offset = pos;
+                return;
+            }
+
+            std::size_t bases = line_len - (line_len > 0 && last == '\r');
+            std::size_t width = line_len + newline;
+            if (!have_record) {
+                if (bases == 0) return;
+                throw std::runtime_error("Sequence data before the first header at line "
+                    + std::to_string(lineno));
+            }
+
+            if (bases == 0) {
+                ended = true;
+                return;
+            }
+            if (ended) inconsistent();
+
+            if (cur.line_bases == 0) {
+                cur.line_bases = bases;
+                cur.line_width = newline ? width : bases + 1;
+            } else if (bases != cur.line_bases || (newline && width != cur.line_width)) {
+                if (bases > cur.line_bases) inconsistent();
+                if (newline && width - bases != cur.line_width - cur.line_bases) inconsistent();
+                ended = true;
+            }
+            cur.length += bases;
+        }
+
+        void finish_record() {
+            if (in_header) end_line(false);
+            if (have_record) entries.push_back(std::move(cur));
+            have_record = false;
+        }
+
+        [[noreturn]] void inconsistent() {
+            throw std::runtime_error("Inconsistent line width in record " + cur.name
+                + " at line " + std::to_string(lineno));
+        }
+
+        // the line being fed isn't counted in lineno yet
+        [[noreturn]] void stray_return() {
+            throw std::runtime_error("Carriage return inside a line of record " + cur.name
+                + " at line " + std::to_string(lineno + 1));
+        }
+
+        // one record found by index_parallel(): its header at head, its
+        // sequence from seq to end, with lines of width bytes checked up to
+        // tail and the rest left to a builder
+        struct Span {
+            std::size_t head, seq, tail, end;
+            std::size_t width;
+            bool cr;
+        };
+
+        static constexpr std::size_t parallel_chunk = 8 << 20;
+
+        static bool index_parallel(const char* data, std::size_t n, unsigned threads,
+                std::vector<FASTAIndexEntry>& entries, bool returns) {
+            // every '>' at the start of a line begins a record
+            std::size_t chunks = (n + parallel_chunk - 1) / parallel_chunk;
+            std::vector<std::vector<std::size_t>> found(chunks);
+            fasta_detail::parallel_for(threads, chunks, [&](std::size_t c) {
+                const char* p = data + c * parallel_chunk;
+                const char* end = data + std::min(n, (c + 1) * parallel_chunk);
+                while ((p = static_cast<const char*>(std::memchr(p, '>', end - p)))) {
+                    if (p == data || p[-1] == '\n') found[c].push_back(p - data);
+                    p++;
+                }
+            });
+
+            std::vector<Span> spans;
+            for (const auto& heads : found) {
+                for (std::size_t h : heads) {
+                    if (!spans.empty()) spans.back().end = h;
+                    spans.push_back(Span{h, 0, 0, n, 0, false});
+                }
+            }
+
+            // lines of width bytes from seq to tail are checked in pieces
+            struct Piece {
+                std::size_t span, from, to;
+            };
+            std::vector<Piece> pieces;
+            for (std::size_t i = 0; i < spans.size(); i++) {
+                Span& s = spans[i];
+                const char* nl = static_cast<const char*>(std::memchr(data + s.head, '\n', s.end - s.head));
+                s.seq = s.tail = nl ? nl - data + 1 : s.end;
+                nl = static_cast<const char*>(std::memchr(data + s.seq, '\n', s.end - s.seq));
+                if (!nl) continue;
+                s.width = nl - data - s.seq + 1;
+                s.cr = s.width >= 2 && nl[-1] == '\r';
+                if (s.width - 1 - s.cr == 0) continue;
+                std::size_t lines = (s.end - s.seq) / s.width;
+                if (lines < 3) continue;
+                s.tail = s.seq + (lines - 2) * s.width;
+                std::size_t step = std::max<std::size_t>(1, parallel_chunk / s.width) * s.width;
+                for (std::size_t from = s.seq; from < s.tail; from += step) {
+                    pieces.push_back(Piece{i, from, std::min(s.tail, from + step)});
+                }
+            }
+
+            std::atomic<bool> regular(true);
+            entries.resize(spans.size());
+            fasta_detail::parallel_for(threads, pieces.size() + spans.size(), [&](std::size_t t) {
+                if (!regular.load(std::memory_order_relaxed)) return;
+                if (t < pieces.size()) {
+                    const Piece& piece = pieces[t];
+                    const Span& s = spans[piece.span];
+                    if (!regular_lines(data + piece.from, piece.to - piece.from, s.width, s.cr, returns)) {
+                        regular = false;
+                    }
+                    return;
+                }
+
+                // the header and the last lines, through a builder
+                const Span& s = spans[t - pieces.size()];
+                FASTAIndexBuilder builder;
+                std::vector<FASTAIndexEntry> e;
+                try {
+                    builder.feed(data + s.head, s.seq - s.head);
+                    builder.feed(data + s.tail, s.end - s.tail);
+                    e = builder.finish();
+                } catch (const std::runtime_error&) {
+                    // line numbers in the error would be wrong
+                    regular = false;
+                    return;
+                }
+                FASTAIndexEntry& rec = e.front();
+                rec.offset += s.head;
+                if (s.tail > s.seq) {
+                    std::size_t bases = s.width - 1 - s.cr;
+                    if (rec.line_bases != bases || rec.line_width != s.width) {
+                        regular = false;
+                        return;
+                    }
+                    rec.length += (s.tail - s.seq) / s.width * bases;
+                }
+                entries[t - pieces.size()] = std::move(rec);
+            });
+            return regular;
+        }
+
+        // true if n bytes are all full lines of width bytes, ending in "\r\n"
+        // if cr is set and in a bare '\n' otherwise. returns says the data
+        // holds some \r, so the bases have to be checked for one.
+        static bool regular_lines(const char* p, std::size_t n, std::size_t width, bool cr, bool returns) {
+            const char* end = p + n;
+            for (const char* line = p; line < end; line += width) {
+                const char* nl = static_cast<const char*>(std::memchr(line, '\n', width));
+                if (nl != line + width - 1) return false;
+                if ((width >= 2 && nl[-1] == '\r') != cr) return false;
+                if (returns && std::memchr(line, '\r', width - 1 - cr)) return false;
+            }
+            return true;
+        }
+};
+
+namespace fasta_detail {
+
+    enum class Compression { None, Gzip, Bgzf };
+
+    // looks for a gzip or BGZF header in the first bytes of a file
+    inline Compression detect_compression(const unsigned char* h, std::size_t n) {
+        if (n < 2 || h[0] != 0x1f || h[1] != 0x8b) return Compression::None;
+        if (n >= 18 && h[2] == 8 && (h[3] & 4) && h[10] == 6 && h[11] == 0
+                && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0) {
+            return Compression::Bgzf;
+        }
+        return Compression::Gzip;
+    }
+
+    inline Compression detect_compression(const std::string& filename) {
+        unsigned char h[18];
+        std::ifstream in(filename, std::ios::binary);
+        in.read(reinterpret_cast<char*>(h), sizeof(h));
+        return detect_compression(h, in.gcount());
+    }
+
+    inline std::uint64_t read_le(const unsigned char* p, int bytes) {
+        std::uint64_t v = 0;
+        for (int i = bytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+        return v;
+    }
+
+    // the most bytes put in one BGZF block, as bgzip does
+    constexpr std::size_t BGZF_BLOCK_DATA = 0xff00;
+
+    inline void write_le(std::ostream& out, std::uint64_t v, int bytes) {
+        char b[8];
+        for (int i = 0; i < bytes; i++) b[i] = static_cast<char>(v >> (8 * i));
+        out.write(b, bytes);
+    }
+
+    // writes index entries in .fai format. returns false on failure.
+    inline bool write_fai(const std::string& filename, const std::vector<FASTAIndexEntry>& entries) {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) return false;
+        for (const auto& r : entries) {
+            out << r.name << '\t' << r.length << '\t' << r.offset << '\t'
+                << r.line_bases << '\t' << r.line_width << '\n';
+        }
+        return static_cast<bool>(out.flush());
+    }
+
+    // a fixed amount of page-aligned memory, filled from the front. a file
+    // written from it a whole buffer at a time gets every write starting
+    // on a page boundary in memory and, past the first, in the file.
+    class AlignedBuffer {
+        public:
+            static constexpr std::size_t ALIGNMENT = 4096;
+
+            explicit AlignedBuffer(std::size_t bytes = 0) { reset(bytes); }
+
+            // drops the contents and makes room for bytes
+            void reset(std::size_t bytes) {
+                mem.reset(bytes ? static_cast<char*>(::operator new(bytes, std::align_val_t(ALIGNMENT))) : nullptr);
+                cap = bytes;
+                used = 0;
+            }
+
+            // copies up to n bytes in, returning how many fitted
+            std::size_t append(const char* p, std::size_t n) {
+                std::size_t k = std::min(n, cap - used);
+                if (k) std::memcpy(mem.get() + used, p, k);
+                used += k;
+                return k;
+            }
+
+            const char* data() const { return mem.get(); }
+            std::size_t size() const { return used; }
+            bool empty() const { return used == 0; }
+            bool full() const { return used == cap; }
+            void clear() { used = 0; }
+
+        private:
+            struct Free {
+                void operator()(char* p) const { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+            };
+
+            std::unique_ptr<char, Free> mem;
+            std::size_t cap = 0;
+            std::size_t used = 0;
+    };
+
+    // a thread-safe LRU cache of immutable blocks of bytes, bounded by their
+    // total size. blocks are shared, so a block in use stays valid after it
+    // is evicted.
+    template <typename Key, typename Hash = std::hash<Key>>
+    class BlockCache {
+        public:
+            using Data = std::shared_ptr<const std::vector<char>>;
+
+            explicit BlockCache(std::size_t capacity = 0): cap(capacity) {}
+
+            // sets the largest total size of the cached blocks
+            void set_capacity(std::size_t bytes) {
+                std::lock_guard<std::mutex> lock(mutex);
+                cap = bytes;
+                trim();
+            }
+
+            // returns the cached block, or null, counting a hit or a miss
+            Data find(const Key& key) const {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = blocks.find(key);
+                if (it == blocks.end()) {
+                    miss_count++;
+                    return nullptr;
+                }
+                hit_count++;
+                lru.splice(lru.begin(), lru, it->second);
+                return it->second->second;
+            }
+
+            void insert(const Key& key, Data data) const {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (blocks.count(key)) return;
+                used += data->size();
+                lru.emplace_front(key, std::move(data));
+                blocks[key] = lru.begin();
+                trim();
+            }
+
+            void clear() const {
+                std::lock_guard<std::mutex> lock(mutex);
+                lru.clear();
+                blocks.clear();
+                used = 0;
+                hit_count = 0;
+                miss_count = 0;
+            }
+
+            std::uint64_t hits() const { std::lock_guard<std::mutex> lock(mutex); return hit_count; }
+            std::uint64_t misses() const { std::lock_guard<std::mutex> lock(mutex); return miss_count; }
+            std::size_t count() const { std::lock_guard<std::mutex> lock(mutex); return lru.size(); }
+            std::size_t bytes() const { std::lock_guard<std::mutex> lock(mutex); return used; }
+
+        private:
+            mutable std::mutex mutex;
+            mutable std::list<std::pair<Key, Data>> lru; // most recent first
+            mutable std::unordered_map<Key, typename std::list<std::pair<Key, Data>>::iterator, Hash> blocks;
+            std::size_t cap;
+            mutable std::size_t used = 0;
+            mutable std::uint64_t hit_count = 0;
+            mutable std::uint64_t miss_count = 0;
+
+            void trim() const {
+                while (used > cap && !lru.empty()) {
+                    used -= lru.back().second->size();
+                    blocks.erase(lru.back().first);
+                    lru.pop_back();
+                }
+            }
+    };
+
+    // a fixed set of worker threads running queued tasks in order. the
+    // destructor finishes the queued tasks before returning.
+    class ThreadPool {
+        public:
+            explicit ThreadPool(unsigned threads = 0) {
+                if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+                for (unsigned i = 0; i < threads; i++) workers.emplace_back([this] { work(); });
+            }
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            ~ThreadPool() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+                for (auto& t : workers) t.join();
+            }
+
+            void submit(std::function<void()> task) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    tasks.push_back(std::move(task));
+                }
+                wake.notify_one();
+            }
+
+            unsigned size() const { return workers.size(); }
+
+        private:
+            std::vector<std::thread> workers;
+            std::list<std::function<void()>> tasks;
+            std::mutex mutex;
+            std::condition_variable wake;
+            bool stopping = false;
+
+            void work() {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                        if (tasks.empty()) return;
+                        task = std::move(tasks.front());
+                        tasks.pop_front();
+                    }
+                    task();
+                }
+            }
+    };
+
+#ifdef FASTA_HAVE_IO_URING
+    // reads byte ranges of files through an io_uring, with one thread
+    // reaping the completions. uses the raw system calls, so liburing is
+    // not needed.
+    class UringReader {
+        public:
+            // called on the reaping thread with the result of the read (the
+            // byte count, or a negative errno) and the buffer read into
+            using Done = std::function<void(long, std::vector<char>&)>;
+
+            UringReader() = default;
+            UringReader(const UringReader&) = delete;
+            UringReader& operator=(const UringReader&) = delete;
+
+            ~UringReader() { stop(); }
+
+            // sets up the ring. returns false if the kernel doesn't allow it.
+            bool start(unsigned entries = 256) {
+                io_uring_params p;
+                std::memset(&p, 0, sizeof(p));
+                ring = syscall(__NR_io_uring_setup, entries, &p);
+                if (ring < 0) return false;
+
+                sq_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+                if (single) sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+                sqe_bytes = p.sq_entries * sizeof(io_uring_sqe);
+                sq_ptr = mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+                cq_ptr = single ? sq_ptr
+                    : mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+                void* s = mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+                if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || s == MAP_FAILED) {
+                    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_bytes);
+                    if (!single && cq_ptr != MAP_FAILED) munmap(cq_ptr, cq_bytes);
+                    if (s != MAP_FAILED) munmap(s, sqe_bytes);
+                    sq_ptr = cq_ptr = nullptr;
+                    ::close(ring);
+                    ring = -1;
+                    return false;
+                }
+
+                char* sq = static_cast<char*>(sq_ptr);
+                char* cq = static_cast<char*>(cq_ptr);
+                sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+                sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+                sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+                sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+                sq_entries = p.sq_entries;
+                sqes = static_cast<io_uring_sqe*>(s);
+                cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+                cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+                cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+                cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+                max_inflight = p.cq_entries;
+
+                reaper = std::thread([this] { reap(); });
+                return true;
+            }
+
+            // true on a thread running a completion. such a thread mustn't
+            // wait for room in a ring, as the room comes from that thread.
+            static bool reaping() { return reaper_flag(); }
+
+            // reads n bytes of fd at offset, then calls done. if the read
+            // can't be submitted this throws, and done is never called. this
+            // waits while the ring is full, so it must not be called by a
+            // completion.
+            void read(int fd, std::uint64_t offset, std::size_t n, Done done) {
+                std::unique_ptr<Request> req(new Request);
+                req->buf.resize(n);
+                req->iov.iov_base = req->buf.data();
+                req->iov.iov_len = n;
+                req->done = std::move(done);
+
+                std::unique_lock<std::mutex> lock(mutex);
+                room.wait(lock, [this] { return inflight < max_inflight; });
+                push(IORING_OP_READV, fd, &req->iov, offset, reinterpret_cast<std::uint64_t>(req.get()));
+                // the reaper owns it now, and can't count it done before
+                // the lock is released
+                inflight++;
+                req.release();
+            }
+
+        private:
+            struct Request {
+                std::vector<char> buf;
+                iovec iov;
+                Done done;
+            };
+
+            int ring = -1;
+            void* sq_ptr = nullptr;
+            void* cq_ptr = nullptr;
+            std::size_t sq_bytes = 0, cq_bytes = 0, sqe_bytes = 0;
+            unsigned* sq_head = nullptr;
+            unsigned* sq_tail = nullptr;
+            unsigned* sq_array = nullptr;
+            unsigned sq_mask = 0, sq_entries = 0;
+            io_uring_sqe* sqes = nullptr;
+            unsigned* cq_head = nullptr;
+            unsigned* cq_tail = nullptr;
+            unsigned cq_mask = 0;
+            io_uring_cqe* cqes = nullptr;
+
+            std::mutex mutex; // guards submissions and inflight
+            std::condition_variable room;
+            std::size_t inflight = 0;
+            std::size_t max_inflight = 0;
+            std::thread reaper;
+
+            // queues one operation and submits it. mutex must be held. if the
+            // submission fails the entry is taken back off the queue, so the
+            // kernel never sees it, and this throws.
+            void push(int op, int fd, const iovec* iov, std::uint64_t offset, std::uint64_t user_data) {
+                unsigned tail = *sq_tail;
+                while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) std::this_thread::yield();
+                unsigned idx = tail & sq_mask;
+                io_uring_sqe* sqe = &sqes[idx];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = op;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<std::uint64_t>(iov);
+                sqe->len = iov ? 1 : 0;
+                sqe->off = offset;
+                sqe->user_data = user_data;
+                sq_array[idx] = idx;
+                __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+                while (syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0) < 0) {
+                    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+                        throw std::runtime_error("io_uring submission failed");
+                    }
+                    std::this_thread::yield();
+                }
+            }
+
+            static bool& reaper_flag() {
+                static thread_local bool flag = false;
+                return flag;
+            }
+
+            void reap() {
+                reaper_flag() = true;
+                for (;;) {
+                    syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    unsigned head = *cq_head;
+                    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+                    // each request was written under the lock before the
+                    // kernel saw it. the kernel orders that already, but
+                    // taking the lock shows it to race checkers too.
+                    if (head != tail) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                    }
+                    bool stopping = false;
+                    std::size_t done = 0;
+                    for (; head != tail; head++) {
+                        const io_uring_cqe& cqe = cqes[head & cq_mask];
+                        Request* req = reinterpret_cast<Request*>(cqe.user_data);
+                        if (!req) {
+                            // the no-op queued by stop()
+                            stopping = true;
+                            continue;
+                        }
+                        long res = cqe.res;
+                        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                        req->done(res, req->buf);
+                        delete req;
+                        done++;
+                    }
+                    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                    if (done) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        inflight -= done;
+                    }
+                    room.notify_all();
+                    if (stopping) return;
+                }
+            }
+
+            // waits for the reads in flight, then shuts the ring down
+            void stop() {
+                if (ring < 0) return;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    room.wait(lock, [this] { return inflight == 0; });
+                    push(IORING_OP_NOP, -1, nullptr, 0, 0);
+                }
+                reaper.join();
+                munmap(sqes, sqe_bytes);
+                if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_bytes);
+                munmap(sq_ptr, sq_bytes);
+                ::close(ring);
+                ring = -1;
+            }
+    };
+#endif /* FASTA_HAVE_IO_URING */
+
+#ifdef FASTA_USE_ZLIB
+    // reads a gzip file, including files of concatenated members like BGZF.
+    // a truncated or damaged file throws once its good data has been read.
+    class GzipStreambuf : public std::streambuf {
+        public:
+            explicit GzipStreambuf(const std::string& filename):
+                gz(gzopen(filename.c_str(), "rb")), name(filename), buf(1 << 18) {
+                if (gz) gzbuffer(gz, 1 << 18);
+            }
+            ~GzipStreambuf() { if (gz) gzclose(gz); }
+
+            bool is_open() const { return gz != nullptr; }
+
+        protected:
+            int_type underflow() override {
+                if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+                int n = gz ? gzread(gz, buf.data(), buf.size()) : -1;
+                if (n <= 0) check();
+                if (n == 0) return traits_type::eof();
+                setg(buf.data(), buf.data(), buf.data() + n);
+                return traits_type::to_int_type(*gptr());
+            }
+
+            // large reads skip the internal buffer
+            std::streamsize xsgetn(char* s, std::streamsize n) override {
+                std::streamsize done = std::min<std::streamsize>(egptr() - gptr(), n);
+                if (done) {
+                    std::memcpy(s, gptr(), done);
+                    gbump(done);
+                }
+                while (gz && done < n) {
+                    int k = gzread(gz, s + done, std::min<std::streamsize>(n - done, 1 << 30));
+                    if (k <= 0) check();
+                    if (k == 0) break;
+                    done += k;
+                }
+                return done;
+            }
+
+        private:
+            gzFile gz;
+            std::string name;
+            std::vector<char> buf;
+
+            // throws if the last read stopped on an error rather than at the
+            // end of the file. zlib reports a truncated file as Z_BUF_ERROR
+            // with nothing read, so that counts as an error too. gzerror's
+            // message starts with the file name.
+            void check() {
+                if (!gz) throw std::runtime_error("Error opening file: " + name + "!");
+                int err;
+                const char* what = gzerror(gz, &err);
+                if (err == Z_ERRNO) throw std::runtime_error("Error reading " + name + ": " + std::strerror(errno));
+                if (err != Z_OK) throw std::runtime_error("Error decompressing " + std::string(what));
+            }
+    };
+
+    class GzipIStream : public std::istream {
+        public:
+            // decompression errors are rethrown out of read() rather than
+            // left as badbit, so they can't pass for the end of the file
+            explicit GzipIStream(const std::string& filename): std::istream(nullptr), sb(filename) {
+                rdbuf(&sb);
+                if (!sb.is_open()) setstate(std::ios::failbit);
+                exceptions(std::ios::badbit);
+            }
+
+        private:
+            GzipStreambuf sb;
+    };
+
+    // random access to BGZF data through the offsets of its blocks, as
+    // stored in a .gzi file. recently inflated blocks are kept in a small
+    // LRU cache.
+    class BGZFReader {
+        public:
+            // reads raw bytes of the compressed file
+            using RawRead = std::function<std::size_t(std::uint64_t, char*, std::size_t)>;
+
+            void reset(RawRead r) {
+                raw = std::move(r);
+                blocks.assign(1, Block{0, 0});
+                cache.clear();
+            }
+
+            // loads a .gzi file. returns false if it could not be opened, and
+            // throws a std::runtime_error if it is malformed.
+            bool load_gzi(const std::string& filename) {
+                std::ifstream in(filename, std::ios::binary);
+                if (!in) return false;
+                load_gzi(in, filename);
+                return true;
+            }
+
+            void load_gzi(std::istream& in, const std::string& filename) {
+                unsigned char b[16];
+                if (!in.read(reinterpret_cast<char*>(b), 8)) bad_gzi(filename);
+                std::uint64_t n = read_le(b, 8);
+                blocks.assign(1, Block{0, 0});
+                for (std::uint64_t i = 0; i < n; i++) {
+                    if (!in.read(reinterpret_cast<char*>(b), 16)) bad_gzi(filename);
+                    Block blk{read_le(b, 8), read_le(b + 8, 8)};
+                    if (blk.coffset <= blocks.back().coffset || blk.uoffset < blocks.back().uoffset) {
+                        bad_gzi(filename);
+                    }
+                    blocks.push_back(blk);
+                }
+            }
+
+            // finds the blocks by walking their headers
+            void build_gzi() {
+                blocks.clear();
+                std::uint64_t coffset = 0;
+                std::uint64_t uoffset = 0;
+                unsigned char h[18];
+                while (raw(coffset, reinterpret_cast<char*>(h), 18) == 18) {
+                    if (detect_compression(h, 18) != Compression::Bgzf) bad_block(coffset);
+                    std::size_t size = read_le(h + 16, 2) + 1;
+                    if (raw(coffset + size - 4, reinterpret_cast<char*>(h), 4) != 4) bad_block(coffset);
+                    blocks.push_back(Block{coffset, uoffset});
+                    uoffset += read_le(h, 4);
+                    coffset += size;
+                }
+                if (blocks.empty()) blocks.push_back(Block{0, 0});
+            }
+
+            // writes the block offsets in .gzi format. returns false on failure.
+            bool write_gzi(const std::string& filename) const {
+                std::ofstream out(filename, std::ios::binary);
+                if (!out) return false;
+                write_le(out, blocks.size() - 1, 8);
+                for (std::size_t i = 1; i < blocks.size(); i++) {
+                    write_le(out, blocks[i].coffset, 8);
+                    write_le(out, blocks[i].uoffset, 8);
+                }
+                return static_cast<bool>(out.flush());
+            }
+
+            // reads up to n uncompressed bytes at offset. returns the number
+            // of bytes read, less than n at the end of the data.
+            std::size_t read(std::uint64_t offset, char* dst, std::size_t n) const {
+                std::size_t i = std::upper_bound(blocks.begin(), blocks.end(), offset,
+                    [](std::uint64_t o, const Block& b) { return o < b.uoffset; }) - blocks.begin() - 1;
+                std::size_t done = 0;
+                for (; done < n && i < blocks.size(); i++) {
+                    BlockData data = block(i);
+                    std::uint64_t at = offset + done - blocks[i].uoffset;
+                    if (at >= data->size()) continue;
+                    std::size_t k = std::min<std::uint64_t>(data->size() - at, n - done);
+                    std::memcpy(dst + done, data->data() + at, k);
+                    done += k;
+                }
+                return done;
+            }
+
+        private:
+            struct Block {
+                std::uint64_t coffset; // offset of the block in the file
+                std::uint64_t uoffset; // offset of its first uncompressed byte
+            };
+            using BlockData = BlockCache<std::size_t>::Data;
+
+            RawRead raw;
+            std::vector<Block> blocks{Block{0, 0}};
+            BlockCache<std::size_t> cache{FASTA_BGZF_CACHE_BLOCKS * std::size_t(65536)};
+
+            BlockData block(std::size_t i) const {
+                BlockData data = cache.find(i);
+                if (!data) {
+                    data = inflate_block(blocks[i].coffset);
+                    cache.insert(i, data);
+                }
+                return data;
+            }
+
+            BlockData inflate_block(std::uint64_t coffset) const {
+                unsigned char h[18];
+                if (raw(coffset, reinterpret_cast<char*>(h), 18) != 18
+                        || detect_compression(h, 18) != Compression::Bgzf) {
+                    bad_block(coffset);
+                }
+                std::size_t size = read_le(h + 16, 2) + 1;
+                std::size_t start = 12 + read_le(h + 10, 2);
+                if (size < start + 8) bad_block(coffset);
+
+                std::vector<unsigned char> in(size);
+                if (raw(coffset, reinterpret_cast<char*>(in.data()), size) != size) bad_block(coffset);
+                std::uint32_t crc = read_le(&in[size - 8], 4);
+                std::uint32_t isize = read_le(&in[size - 4], 4);
+
+                auto out = std::make_shared<std::vector<char>>(isize);
+                if (isize == 0) return out;
+                z_stream zs{};
+                if (inflateInit2(&zs, -15) != Z_OK) bad_block(coffset);
+                zs.next_in = in.data() + start;
+                zs.avail_in = size - start - 8;
+                zs.next_out = reinterpret_cast<Bytef*>(out->data());
+                zs.avail_out = isize;
+                int rc = inflate(&zs, Z_FINISH);
+                inflateEnd(&zs);
+                if (rc != Z_STREAM_END || zs.total_out != isize
+                        || crc32(0, reinterpret_cast<const Bytef*>(out->data()), isize) != crc) {
+                    bad_block(coffset);
+                }
+                return out;
+            }
+
+            [[noreturn]] static void bad_gzi(const std::string& filename) {
+                throw std::runtime_error("Malformed BGZF index " + filename);
+            }
+
+            [[noreturn]] static void bad_block(std::uint64_t coffset) {
+                throw std::runtime_error("Invalid BGZF block at offset " + std::to_string(coffset));
+            }
+    };
+
+    // the empty block that ends a BGZF file
+    constexpr unsigned char BGZF_EOF[28] = {
+        0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    // compresses n bytes, at most BGZF_BLOCK_DATA, into one BGZF block.
+    // input that doesn't shrink is stored instead, so the block always fits.
+    inline std::string bgzf_block(const char* p, std::size_t n, int level = Z_DEFAULT_COMPRESSION) {
+        std::string out(65536, '\0');
+        unsigned char* b = reinterpret_cast<unsigned char*>(&out[0]);
+        static const unsigned char header[16] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0};
+        std::memcpy(b, header, 16);
+        std::size_t size = 0;
+        for (int lv : {level, 0}) {
+            z_stream zs{};
+            if (deflateInit2(&zs, lv, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                throw std::runtime_error("Error starting BGZF compression");
+            }
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+            zs.avail_in = n;
+            zs.next_out = b + 18;
+            zs.avail_out = out.size() - 18 - 8;
+            int rc = deflate(&zs, Z_FINISH);
+            deflateEnd(&zs);
+            if (rc == Z_STREAM_END) {
+                size = 18 + zs.total_out + 8;
+                break;
+            }
+            if (lv == 0) throw std::runtime_error("Error compressing BGZF block");
+        }
+        std::uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(p), n);
+        for (int i = 0; i < 4; i++) {
+            b[size - 8 + i] = static_cast<unsigned char>(crc >> (8 * i));
+            b[size - 4 + i] = static_cast<unsigned char>(n >> (8 * i));
+        }
+        b[16] = static_cast<unsigned char>((size - 1) & 0xff);
+        b[17] = static_cast<unsigned char>((size - 1) >> 8);
+        out.resize(size);
+        return out;
+    }
+#endif /* FASTA_USE_ZLIB */
+
+    // opens a file for sequential reading, decompressing it if needed
+    inline std::unique_ptr<std::istream> open_input(const std::string& filename) {
+        if (detect_compression(filename) != Compression::None) {
+#ifdef FASTA_USE_ZLIB
+            return std::unique_ptr<std::istream>(new GzipIStream(filename));
+#else
+            throw std::runtime_error("Reading compressed file " + filename + " needs FASTA_USE_ZLIB!");
+#endif
+        }
+        return std::unique_ptr<std::istream>(new std::ifstream(filename, std::ios::binary));
+    }
+
+} /* namespace fasta_detail */
+
+// one record read by FASTAReader
+struct FASTARecord {
+    std::string name;        // header text up to the first whitespace
+    std::string description; // the rest of the header
+    std::string sequence;    // bases with line endings removed
+    std::string quality;     // FASTQ quality string; empty for FASTA
+};
+
+// reads every record of a FASTA file in one buffered pass. one FASTARecord
+// is reused for all records, so its strings keep their storage between
+// iterations:
+//     for (auto& rec : FASTAReader("file.fa")) { ... }
+// if the first record starts with '@' the input is read as FASTQ instead,
+// with sequence and quality lines allowed to wrap.
+class FASTAReader {
+    public:
+        // reads the file, throwing a std::runtime_error if it can't be opened.
+        // gzip-compressed files are decompressed when built with FASTA_USE_ZLIB.
+        explicit FASTAReader(const std::string& filename):
+            owned(fasta_detail::open_input(filename)), in(owned.get()), block(FASTA_BLOCK_SIZE) {
+            if (!*in) {
+                throw std::runtime_error("Error opening file: " + filename + "!");
+            }
+        }
+
+        // reads from a stream, such as std::cin, in large blocks and without
+        // seeking. the stream must outlive the reader.
+        explicit FASTAReader(std::istream& stream): in(&stream), block(FASTA_BLOCK_SIZE) {}
+
+#ifdef FASTA_HAVE_POSIX
+        // reads from a file descriptor, such as a pipe or socket, without
+        // seeking. each read takes whatever has arrived, so records are
+        // parsed as the data comes in. the descriptor is not closed.
+        explicit FASTAReader(int descriptor): fd(descriptor), block(FASTA_BLOCK_SIZE) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+            // a hint for regular files; pipes just refuse it
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        }
+#endif
+
+        // reads records from n bytes of memory, without copying them. the
+        // memory must outlive the reader.
+        FASTAReader(const char* data, std::size_t n): buf(data), len(n) {}
+
+        // reads the next record into rec. returns false after the last one.
+        // throws a std::runtime_error for a truncated FASTQ record or one
+        // whose quality string is longer than its sequence.
+        bool next(FASTARecord& rec) {
+            // find the next header. the first one decides the format.
+            for (;;) {
+                if (pos == len && !fill()) return false;
+                if (line_start && (buf[pos] == '>' || buf[pos] == '@')) {
+                    if (!format_known) {
+                        fastq_input = buf[pos] == '@';
+                        format_known = true;
+                    }
+                    if (buf[pos] == (fastq_input ? '@' : '>')) break;
+                }
+                skip_line();
+            }
+            pos++;
+            line_start = false;
+
+            header.clear();
+            read_line(header);
+            if (!header.empty() && header.back() == '\r') header.pop_back();
+            std::size_t split = 0;
+            while (split < header.size() && !std::isspace(static_cast<unsigned char>(header[split]))) split++;
+            rec.name.assign(header, 0, split);
+            while (split < header.size() && std::isspace(static_cast<unsigned char>(header[split]))) split++;
+            rec.description.assign(header, split, std::string::npos);
+
+            // sequence lines run up to the next '>' at the start of a line,
+            // or for FASTQ the '+' line before the quality
+            const char mark = fastq_input ? '+' : '>';
+            rec.sequence.clear();
+            rec.quality.clear();
+            for (;;) {
+                if (pos == len && !fill()) break;
+                if (line_start && buf[pos] == mark) break;
+
+                const char* p = buf + pos;
+                const char* end = buf + len;
+                const char* q = p;
+                while ((q = static_cast<const char*>(std::memchr(q, mark, end - q)))) {
+                    if (q > p && q[-1] == '\n') break;
+                    q++;
+                }
+                const char* stop = q ? q : end;
+                append_bases(rec.sequence, p, stop - p);
+                pos = stop - buf;
+                line_start = stop[-1] == '\n';
+            }
+            if (fastq_input) read_quality(rec);
+            return true;
+        }
+
+        // true once a record has been read from FASTQ input
+        bool fastq() const { return format_known && fastq_input; }
+
+        class iterator {
+            public:
+                using iterator_category = std::input_iterator_tag;
+                using value_type = FASTARecord;
+                using difference_type = std::ptrdiff_t;
+                using pointer = FASTARecord*;
+                using reference = FASTARecord&;
+
+                iterator() = default;
+                explicit iterator(FASTAReader* r): reader(r) { ++*this; }
+
+                reference operator*() const { return reader->current; }
+                pointer operator->() const { return &reader->current; }
+                iterator& operator++() {
+                    if (!reader->next(reader->current)) reader = nullptr;
+                    return *this;
+                }
+                bool operator==(const iterator& o) const { return reader == o.reader; }
+                bool operator!=(const iterator& o) const { return reader != o.reader; }
+
+            private:
+                FASTAReader* reader = nullptr;
+        };
+
+        // begin() starts reading, so a reader can only be iterated once
+        iterator begin() { return iterator(this); }
+        iterator end() { return iterator(); }
+
+    private:
+        std::unique_ptr<std::istream> owned; // set when the reader opened the file
+        std::istream* in = nullptr; // null when reading from memory or a descriptor
+        int fd = -1;
+        std::vector<char> block;
+        const char* buf = nullptr;
+        std::size_t len = 0;
+        std::size_t pos = 0;
+        bool line_start = true;
+        bool format_known = false;
+        bool fastq_input = false;
+        std::string header;
+        FASTARecord current;
+
+        // skips the '+' line, then reads quality lines until there are as
+        // many symbols as bases. they may start with '@' or '+', so only the
+        // count tells where the record ends.
+        void read_quality(FASTARecord& rec) {
+            if (pos == len && !fill()) {
+                throw std::runtime_error("Truncated FASTQ record " + rec.name);
+            }
+            do {
+                skip_line();
+            } while (!line_start && (pos < len || fill()));
+            while (rec.quality.size() < rec.sequence.size()) {
+                if (pos == len && !fill()) break;
+                std::size_t old = rec.quality.size();
+                read_line(rec.quality);
+                if (rec.quality.size() > old && rec.quality.back() == '\r') rec.quality.pop_back();
+            }
+            if (rec.quality.size() != rec.sequence.size()) {
+                throw std::runtime_error("Quality length doesn't match sequence in FASTQ record " + rec.name);
+            }
+        }
+
+        // refills the buffer from the stream or descriptor. returns false at
+        // end of input, and throws if the stream fails.
+        bool fill() {
+            std::size_t n = 0;
+            if (in) {
+                if (in->bad()) throw std::runtime_error("Error reading input");
+                if (in->eof()) return false;
+                in->read(block.data(), block.size());
+                if (in->bad()) throw std::runtime_error("Error reading input");
+                n = in->gcount();
+            } else if (fd >= 0) {
+#ifdef FASTA_HAVE_POSIX
+                ssize_t k;
+                while ((k = ::read(fd, block.data(), block.size())) < 0 && errno == EINTR) {}
+                if (k < 0) throw std::runtime_error("Error reading input: " + std::string(std::strerror(errno)));
+                n = k;
+#endif
+            } else {
+                return false;
+            }
+            buf = block.data();
+            len = n;
+            pos = 0;
+            return len > 0;
+        }
+
+        void skip_line() {
+            const char* nl = static_cast<const char*>(std::memchr(buf + pos, '\n', len - pos));
+            line_start = nl != nullptr;
+            pos = nl ? nl - buf + 1 : len;
+        }
+
+        // appends the rest of the current line to out, minus the '\n'
+        void read_line(std::string& out) {
+            for (;;) {
+                if (pos == len && !fill()) return;
+                const char* nl = static_cast<const char*>(std::memchr(buf + pos, '\n', len - pos));
+                std::size_t stop = nl ? nl - buf : len;
+                out.append(buf + pos, stop - pos);
+                pos = stop;
+                if (nl) {
+                    pos++;
+                    line_start = true;
+                    return;
+                }
+            }
+        }
+
+        static void append_bases(std::string& seq, const char* p, std::size_t n) {
+            std::size_t old = seq.size();
+            seq.resize(old + n);
+            seq.resize(old + fasta_strip_copy(&seq[old], p, n));
+        }
+};
+
+// every name and sequence of a file, loaded by FASTAFile::load_all() into
+// one block of memory: a header, a table of fixed-size entries, the entry
+// numbers sorted by name, then all names and all bases back to back. the
+// block holds offsets rather than pointers, so it can be used wherever it
+// is placed, and freeing it is a single deallocation.
+class FASTASequences {
+    public:
+        static constexpr std::size_t npos = std::size_t(-1);
+
+        FASTASequences() = default;
+
+        std::size_t size() const { return header() ? header()->count : 0; }
+        bool empty() const { return size() == 0; }
+
+        std::string_view name(std::size_t i) const {
+            const Entry& e = entry(i);
+            return std::string_view(base + e.name_off, e.name_len);
+        }
+
+        std::string_view sequence(std::size_t i) const {
+            const Entry& e = entry(i);
+            return std::string_view(base + e.seq_off, e.length);
+        }
+
+        // the bases of the named record, throwing a std::runtime_error if
+        // there is none
+        std::string_view sequence(std::string_view name) const {
+            std::size_t i = find(name);
+            if (i == npos) throw std::runtime_error("No such record: " + std::string(name));
+            return sequence(i);
+        }
+
+        // the entry number of a name, or npos. the first of several records
+        // with the same name is found, as with FASTAFile.
+        std::size_t find(std::string_view name) const {
+            if (empty()) return npos;
+            const std::uint64_t* order = by_name();
+            const std::uint64_t* it = std::lower_bound(order, order + size(), name,
+                [this](std::uint64_t i, std::string_view n) { return this->name(i) < n; });
+            if (it == order + size() || this->name(*it) != name) return npos;
+            return *it;
+        }
+
+        // the whole block and its size in bytes
+        const char* data() const { return base; }
+        std::size_t bytes() const { return header() ? header()->bytes : 0; }
+
+    private:
+        friend class FASTAFile;
+
+        static constexpr std::uint32_t magic = 0x53414646; // "FFAS"
+
+        struct Header {
+            std::uint32_t magic;
+            std::uint32_t reserved;
+            std::uint64_t count;
+            std::uint64_t bytes;
+        };
+
+        struct Entry {
+            std::uint64_t name_off;
+            std::uint64_t seq_off;
+            std::uint64_t length;
+            std::uint64_t name_len;
+        };
+
+        std::unique_ptr<char[]> owned;
+        const char* base = nullptr;
+
+        const Header* header() const { return reinterpret_cast<const Header*>(base); }
+        const Entry* entries() const { return reinterpret_cast<const Entry*>(base + sizeof(Header)); }
+        const std::uint64_t* by_name() const {
+            return reinterpret_cast<const std::uint64_t*>(base + sizeof(Header) + size() * sizeof(Entry));
+        }
+
+        const Entry& entry(std::size_t i) const {
+            if (i >= size()) throw std::out_of_range("FASTASequences index out of range");
+            return entries()[i];
+        }
+
+        // the size of the block for these records
+        static std::size_t image_bytes(const std::vector<FASTAIndexEntry>& recs) {
+            std::size_t bytes = sizeof(Header) + recs.size() * (sizeof(Entry) + sizeof(std::uint64_t));
+            for (const auto& r : recs) bytes += r.name.size() + r.length;
+            return bytes;
+        }
+
+        // lays out the block at dst for these records, leaving the bases to
+        // be filled in at each seq_off. the magic number is left 0 until
+        // finish_image(), so a half-written block is never taken as valid.
+        static void write_image(char* dst, const std::vector<FASTAIndexEntry>& recs) {
+            std::size_t count = recs.size();
+            Header* h = reinterpret_cast<Header*>(dst);
+            h->magic = 0;
+            h->reserved = 0;
+            h->count = count;
+            h->bytes = image_bytes(recs);
+
+            Entry* e = reinterpret_cast<Entry*>(dst + sizeof(Header));
+            std::uint64_t at = sizeof(Header) + count * (sizeof(Entry) + sizeof(std::uint64_t));
+            for (std::size_t i = 0; i < count; i++) {
+                e[i].name_off = at;
+                e[i].name_len = recs[i].name.size();
+                std::memcpy(dst + at, recs[i].name.data(), recs[i].name.size());
+                at += recs[i].name.size();
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                e[i].seq_off = at;
+                e[i].length = recs[i].length;
+                at += recs[i].length;
+            }
+
+            std::uint64_t* order = reinterpret_cast<std::uint64_t*>(e + count);
+            for (std::size_t i = 0; i < count; i++) order[i] = i;
+            std::stable_sort(order, order + count, [&recs](std::uint64_t a, std::uint64_t b) {
+                return recs[a].name < recs[b].name;
+            });
+        }
+
+        static void finish_image(char* dst) {
+            __atomic_store_n(&reinterpret_cast<Header*>(dst)->magic, magic, __ATOMIC_RELEASE);
+        }
+
+        // true if the n bytes at src hold a finished block
+        static bool valid_image(const char* src, std::size_t n) {
+            if (n < sizeof(Header)) return false;
+            const Header* h = reinterpret_cast<const Header*>(src);
+            return __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == magic && h->bytes <= n
+                && h->count <= (n - sizeof(Header)) / (sizeof(Entry) + sizeof(std::uint64_t));
+        }
+
+        static char* bases(char* image, std::size_t i) {
+            return image + reinterpret_cast<const Entry*>(image + sizeof(Header))[i].seq_off;
+        }
+};
+
+// where a FASTAFile opened with open(source) gets its bytes. read_at may be
+// called from several threads at once.
+class FASTAByteSource {
+    public:
+        virtual ~FASTAByteSource() = default;
+
+        // reads up to n bytes at offset. returns the number of bytes read,
+        // less than n only at the end. throws a std::runtime_error on
+        // failure.
+        virtual std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const = 0;
+
+        // the size of the file in bytes
+        virtual std::uint64_t size() const = 0;
+
+        // the whole file, if the source holds it in memory, or null. a
+        // FASTAFile then reads it as it would with the Mmap backend.
+        virtual const char* data() const { return nullptr; }
+
+        // what to call the source in error messages
+        virtual std::string name() const = 0;
+};
+
+namespace fasta_detail {
+
+    // reads a whole source into a string
+    inline std::string read_all(const FASTAByteSource& src) {
+        std::string ret(src.size(), '\0');
+        ret.resize(src.read_at(0, &ret[0], ret.size()));
+        return ret;
+    }
+
+} /* namespace fasta_detail */
+
+// a local file
+class FASTAFileSource : public FASTAByteSource {
+    public:
+        explicit FASTAFileSource(const std::string& filename): path(filename) {
+#ifdef FASTA_HAVE_POSIX
+            fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                if (fd >= 0) ::close(fd);
+                throw std::runtime_error("Error opening file: " + path + "!");
+            }
+            bytes = st.st_size;
+#else
+            in.open(path, std::ios::binary | std::ios::ate);
+            if (!in) throw std::runtime_error("Error opening file: " + path + "!");
+            bytes = in.tellg();
+#endif
+        }
+        FASTAFileSource(const FASTAFileSource&) = delete;
+        FASTAFileSource& operator=(const FASTAFileSource&) = delete;
+
+        ~FASTAFileSource() {
+#ifdef FASTA_HAVE_POSIX
+            ::close(fd);
+#endif
+        }
+
+        std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const override {
+#ifdef FASTA_HAVE_POSIX
+            std::size_t done = 0;
+            while (done < n) {
+                ssize_t k = ::pread(fd, dst + done, n - done, offset + done);
+                if (k < 0 && errno == EINTR) continue;
+                if (k < 0) throw std::runtime_error("Error reading file: " + path + "!");
+                if (k == 0) break;
+                done += k;
+            }
+            return done;
+#else
+            std::lock_guard<std::mutex> lock(mutex);
+            in.clear();
+            in.seekg(offset);
+            in.read(dst, n);
+            std::size_t done = in.gcount();
+            in.clear();
+            return done;
+#endif
+        }
+
+        std::uint64_t size() const override { return bytes; }
+        std::string name() const override { return path; }
+
+    private:
+        std::string path;
+        std::uint64_t bytes = 0;
+#ifdef FASTA_HAVE_POSIX
+        int fd = -1;
+#else
+        mutable std::mutex mutex;
+        mutable std::ifstream in;
+#endif
+};
+
+#ifdef FASTA_HAVE_POSIX
+// a local file mapped read-only
+class FASTAMappedSource : public FASTAByteSource {
+    public:
+        explicit FASTAMappedSource(const std::string& filename): path(filename) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                if (fd >= 0) ::close(fd);
+                throw std::runtime_error("Error opening file: " + path + "!");
+            }
+            if (st.st_size > 0) {
+                void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("Error mapping file: " + path + "!");
+                }
+                map = static_cast<const char*>(p);
+                bytes = st.st_size;
+            }
+            ::close(fd);
+        }
+        FASTAMappedSource(const FASTAMappedSource&) = delete;
+        FASTAMappedSource& operator=(const FASTAMappedSource&) = delete;
+
+        ~FASTAMappedSource() {
+            if (map) munmap(const_cast<char*>(map), bytes);
+        }
+
+        std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const override {
+            if (offset >= bytes) return 0;
+            n = std::min<std::uint64_t>(n, bytes - offset);
+            std::memcpy(dst, map + offset, n);
+            return n;
+        }
+
+        std::uint64_t size() const override { return bytes; }
+        const char* data() const override { return map; }
+        std::string name() const override { return path; }
+
+    private:
+        std::string path;
+        const char* map = nullptr;
+        std::uint64_t bytes = 0;
+};
+#endif
+
+// keeps recently read blocks of another source in memory, for sources
+// where each read is costly. a read takes the blocks it covers; all the
+// missing blocks in a row are fetched with one read of the source, and a
+// block already being fetched for another thread is waited for rather than
+// fetched again. reads that carry on from the last one also fetch the
+// next few blocks, so a sweep makes a few large reads.
+class FASTACachedSource : public FASTAByteSource {
+    public:
+        FASTACachedSource(std::shared_ptr<FASTAByteSource> source, std::size_t bytes,
+                std::size_t block_size = 256 << 10, std::size_t readahead_blocks = 8):
+            inner(std::move(source)), block(std::max<std::size_t>(block_size, 1)), ahead(readahead_blocks),
+            cache(bytes) {}
+
+        std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const override {
+            std::uint64_t total = inner->size();
+            if (offset >= total || n == 0) return 0;
+            n = std::min<std::uint64_t>(n, total - offset);
+            std::uint64_t b0 = offset / block;
+            std::size_t count = (offset + n - 1) / block - b0 + 1;
+            std::uint64_t last = last_block.exchange(b0 + count - 1, std::memory_order_relaxed);
+            bool sequential = b0 == last || b0 == last + 1;
+            std::uint64_t blocks_total = (total + block - 1) / block;
+            std::size_t wanted = count;
+            if (sequential) wanted = std::min<std::uint64_t>(count + ahead, blocks_total - b0);
+
+            // find the cached blocks, and claim the missing ones no other
+            // thread is fetching. blocks read ahead are claimed only while
+            // they follow on from a claimed one.
+            std::vector<Data> blocks(wanted);
+            std::vector<std::shared_future<Data>> others(wanted);
+            std::vector<std::promise<Data>> mine(wanted);
+            std::vector<bool> claimed(wanted);
+            {
+                std::lock_guard<std::mutex> lock(flight_mutex);
+                for (std::size_t i = 0; i < wanted; i++) {
+                    if (i >= count && !claimed[i - 1]) {
+                        wanted = i;
+                        break;
+                    }
+                    if ((blocks[i] = cache.find(b0 + i))) continue;
+                    auto it = in_flight.find(b0 + i);
+                    if (it != in_flight.end()) {
+                        others[i] = it->second;
+                    } else {
+                        claimed[i] = true;
+                        in_flight.emplace(b0 + i, mine[i].get_future().share());
+                    }
+                }
+            }
+
+            std::size_t i = 0;
+            try {
+                while (i < wanted) {
+                    if (!claimed[i]) {
+                        i++;
+                        continue;
+                    }
+                    std::size_t j = i;
+                    while (j < wanted && claimed[j]) j++;
+                    fetch(b0 + i, j - i, &blocks[i]);
+                    std::lock_guard<std::mutex> lock(flight_mutex);
+                    for (; i < j; i++) {
+                        mine[i].set_value(blocks[i]);
+                        claimed[i] = false;
+                        in_flight.erase(b0 + i);
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(flight_mutex);
+                for (std::size_t k = 0; k < wanted; k++) {
+                    if (!claimed[k]) continue;
+                    mine[k].set_exception(std::current_exception());
+                    in_flight.erase(b0 + k);
+                }
+                throw;
+            }
+
+            std::size_t done = 0;
+            for (std::size_t k = 0; k < count; k++) {
+                if (!blocks[k]) blocks[k] = others[k].get();
+                std::uint64_t start = (b0 + k) * block;
+                std::uint64_t at = std::max(offset, start) - start;
+                if (at >= blocks[k]->size()) break;
+                std::size_t m = std::min<std::uint64_t>(blocks[k]->size() - at, n - done);
+                std::memcpy(dst + done, blocks[k]->data() + at, m);
+                done += m;
+            }
+            return done;
+        }
+
+        std::uint64_t size() const override { return inner->size(); }
+        std::string name() const override { return inner->name(); }
+
+        std::uint64_t hits() const { return cache.hits(); }
+        std::uint64_t misses() const { return cache.misses(); }
+
+    private:
+        using Data = fasta_detail::BlockCache<std::uint64_t>::Data;
+
+        std::shared_ptr<FASTAByteSource> inner;
+        std::size_t block;
+        std::size_t ahead; // blocks read ahead of a sequential read
+        mutable fasta_detail::BlockCache<std::uint64_t> cache;
+        mutable std::atomic<std::uint64_t> last_block{~std::uint64_t(0) - 1}; // the end of the last read
+        mutable std::mutex flight_mutex;
+        mutable std::unordered_map<std::uint64_t, std::shared_future<Data>> in_flight;
+
+        // reads count blocks from first on with one read, and caches them
+        void fetch(std::uint64_t first, std::size_t count, Data* out) const {
+            std::uint64_t offset = first * block;
+            std::size_t len = std::min<std::uint64_t>(count * block, inner->size() - offset);
+            std::vector<char> buf(len);
+            if (inner->read_at(offset, buf.data(), len) != len) {
+                throw std::runtime_error("Short read from " + inner->name());
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                std::size_t at = i * block;
+                std::size_t m = std::min(block, len - std::min(at, len));
+                auto data = std::make_shared<std::vector<char>>(buf.begin() + at, buf.begin() + at + m);
+                cache.insert(first + i, data);
+                out[i] = data;
+            }
+        }
+};
+
+#ifdef FASTA_HAVE_POSIX
+// an object on an HTTP server, read with range requests over kept-alive
+// connections. only plain http:// URLs are understood; a source doing TLS
+// (or using an object store's own client) can be plugged in the same way.
+// an HTTP status other than the range asked for
+class FASTAHttpError : public std::runtime_error {
+    public:
+        FASTAHttpError(int status, const std::string& what): std::runtime_error(what), code(status) {}
+
+        int status() const { return code; }
+
+    private:
+        int code;
+};
+
+class FASTAHttpSource : public FASTAByteSource {
+    public:
+        // headers are sent with every request, for example
+        // "Authorization: Bearer TOKEN". throws a std::runtime_error if the
+        // URL can't be used, or a FASTAHttpError if the server answers with
+        // an error status such as 404.
+        explicit FASTAHttpSource(const std::string& url, std::vector<std::string> headers = {}):
+            address(url), extra(std::move(headers)) {
+            const std::string scheme = "http://";
+            if (url.compare(0, scheme.size(), scheme) != 0) {
+                throw std::runtime_error("Only http:// URLs are supported: " + url);
+            }
+            std::size_t slash = url.find('/', scheme.size());
+            std::string hostport = url.substr(scheme.size(), slash - scheme.size());
+            path = slash == std::string::npos ? "/" : url.substr(slash);
+            std::size_t colon = hostport.rfind(':');
+            host = hostport.substr(0, colon);
+            port = colon == std::string::npos ? "80" : hostport.substr(colon + 1);
+            if (host.empty() || port.empty()) throw std::runtime_error("Invalid URL: " + url);
+
+            // a one-byte request tells the size, and that ranges work
+            char c;
+            Response r = request(0, 1, &c);
+            bytes = r.total;
+        }
+        FASTAHttpSource(const FASTAHttpSource&) = delete;
+        FASTAHttpSource& operator=(const FASTAHttpSource&) = delete;
+
+        ~FASTAHttpSource() {
+            for (int s : idle) ::close(s);
+        }
+
+        std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const override {
+            if (offset >= bytes || n == 0) return 0;
+            n = std::min<std::uint64_t>(n, bytes - offset);
+            return request(offset, n, dst).length;
+        }
+
+        std::uint64_t size() const override { return bytes; }
+        std::string name() const override { return address; }
+
+    private:
+        struct Response {
+            std::size_t length = 0;  // body bytes written
+            std::uint64_t total = 0; // size of the whole object
+        };
+
+        std::string address;
+        std::vector<std::string> extra;
+        std::string host;
+        std::string port;
+        std::string path;
+        std::uint64_t bytes = 0;
+        mutable std::mutex idle_mutex;
+        mutable std::vector<int> idle; // open connections not in use
+
+        // asks for n bytes at offset. a kept-alive connection the server
+        // has closed is retried once on a new one.
+        Response request(std::uint64_t offset, std::size_t n, char* dst) const {
+            for (int attempt = 0;; attempt++) {
+                bool reused;
+                int s = connection(reused);
+                Response r;
+                bool keep = false;
+                bool sent = false;
+                try {
+                    sent = exchange(s, offset, n, dst, r, keep);
+                } catch (...) {
+                    ::close(s);
+                    throw;
+                }
+                if (sent) {
+                    if (keep) {
+                        std::lock_guard<std::mutex> lock(idle_mutex);
+                        idle.push_back(s);
+                    } else {
+                        ::close(s);
+                    }
+                    return r;
+                }
+                ::close(s);
+                if (!reused || attempt > 0) throw std::runtime_error("Error reading " + address);
+            }
+        }
+
+        int connection(bool& reused) const {
+            {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                if (!idle.empty()) {
+                    int s = idle.back();
+                    idle.pop_back();
+                    reused = true;
+                    return s;
+                }
+            }
+            reused = false;
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* res = nullptr;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+                throw std::runtime_error("Can't resolve " + host);
+            }
+            int s = -1;
+            for (addrinfo* a = res; a && s < 0; a = a->ai_next) {
+                s = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (s >= 0 && ::connect(s, a->ai_addr, a->ai_addrlen) != 0) {
+                    ::close(s);
+                    s = -1;
+                }
+            }
+            freeaddrinfo(res);
+            if (s < 0) throw std::runtime_error("Can't connect to " + host + ":" + port);
+            timeval tv{60, 0};
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            return s;
+        }
+
+        // sends one range request and reads the answer into dst. returns
+        // false if the connection failed before any answer came.
+        bool exchange(int s, std::uint64_t offset, std::size_t n, char* dst, Response& r, bool& keep) const {
+            std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host
+                + "\r\nRange: bytes=" + std::to_string(offset) + "-" + std::to_string(offset + n - 1) + "\r\n";
+            for (const auto& h : extra) req += h + "\r\n";
+            req += "\r\n";
+            for (std::size_t done = 0; done < req.size();) {
+#ifdef MSG_NOSIGNAL
+                ssize_t k = ::send(s, req.data() + done, req.size() - done, MSG_NOSIGNAL);
+#else
+                ssize_t k = ::send(s, req.data() + done, req.size() - done, 0);
+#endif
+                if (k < 0 && errno == EINTR) continue;
+                if (k <= 0) return false;
+                done += k;
+            }
+
+            // the status line and headers
+            std::string head;
+            char buf[4096];
+            std::size_t end;
+            while ((end = head.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t k = ::recv(s, buf, sizeof(buf), 0);
+                if (k < 0 && errno == EINTR) continue;
+                if (k <= 0) {
+                    if (head.empty()) return false;
+                    throw std::runtime_error("Truncated response from " + address);
+                }
+                head.append(buf, k);
+                if (head.size() > (1 << 20)) throw std::runtime_error("Bad response from " + address);
+            }
+            std::string body = head.substr(end + 4);
+            head.resize(end + 2);
+
+            int status = 0;
+            std::uint64_t length = 0;
+            bool have_length = false;
+            std::string range;
+            keep = true;
+            std::size_t line_end = head.find("\r\n");
+            std::string status_line = head.substr(0, line_end);
+            if (status_line.compare(0, 5, "HTTP/") != 0 || status_line.size() < 12) {
+                throw std::runtime_error("Bad response from " + address);
+            }
+            status = std::atoi(status_line.c_str() + 9);
+            keep = status_line.compare(0, 8, "HTTP/1.0") != 0;
+            for (std::size_t at = line_end + 2; at < head.size();) {
+                std::size_t next = head.find("\r\n", at);
+                std::string line = head.substr(at, next - at);
+                at = next + 2;
+                std::size_t colon = line.find(':');
+                if (colon == std::string::npos) continue;
+                std::string key = line.substr(0, colon);
+                for (auto& ch : key) ch = std::tolower(static_cast<unsigned char>(ch));
+                std::size_t v = line.find_first_not_of(" \t", colon + 1);
+                std::string value = v == std::string::npos ? "" : line.substr(v);
+                if (key == "content-length") {
+                    length = std::strtoull(value.c_str(), nullptr, 10);
+                    have_length = true;
+                } else if (key == "content-range") {
+                    range = value;
+                } else if (key == "connection") {
+                    for (auto& ch : value) ch = std::tolower(static_cast<unsigned char>(ch));
+                    keep = value.find("close") == std::string::npos;
+                } else if (key == "transfer-encoding") {
+                    throw std::runtime_error("Unsupported transfer encoding from " + address);
+                }
+            }
+
+            // the total comes after the '/' of "bytes a-b/total" or "bytes */total"
+            std::size_t total_at = range.rfind('/');
+            if (total_at != std::string::npos) r.total = std::strtoull(range.c_str() + total_at + 1, nullptr, 10);
+            if (status == 416) {
+                r.length = 0;
+                return skip_body(s, body, length, keep);
+            }
+            if (status == 200) throw FASTAHttpError(status, "Range requests aren't supported by " + address);
+            if (status != 206) throw FASTAHttpError(status, "HTTP " + std::to_string(status) + " from " + address);
+
+            // the body must be exactly the range asked for, or its end if
+            // the object is shorter
+            std::uint64_t first = 0, last = 0;
+            bool parsed = range.compare(0, 6, "bytes ") == 0;
+            if (parsed) {
+                char* dash;
+                first = std::strtoull(range.c_str() + 6, &dash, 10);
+                parsed = dash > range.c_str() + 6 && *dash == '-';
+                if (parsed) {
+                    char* slash;
+                    last = std::strtoull(dash + 1, &slash, 10);
+                    parsed = slash > dash + 1 && *slash == '/';
+                }
+            }
+            if (!have_length || !parsed || first != offset || last < first || last - first + 1 != length || length > n
+                    || (length < n && last + 1 != r.total)) {
+                throw std::runtime_error("Wrong range in the response from " + address);
+            }
+
+            std::size_t have = std::min<std::size_t>(body.size(), length);
+            std::memcpy(dst, body.data(), have);
+            while (have < length) {
+                ssize_t k = ::recv(s, dst + have, length - have, 0);
+                if (k < 0 && errno == EINTR) continue;
+                if (k <= 0) throw std::runtime_error("Truncated response from " + address);
+                have += k;
+            }
+            r.length = length;
+            return true;
+        }
+
+        bool skip_body(int s, const std::string& body, std::uint64_t length, bool& keep) const {
+            char buf[4096];
+            for (std::uint64_t have = body.size(); have < length;) {
+                ssize_t k = ::recv(s, buf, std::min<std::uint64_t>(sizeof(buf), length - have), 0);
+                if (k < 0 && errno == EINTR) continue;
+                if (k <= 0) {
+                    keep = false;
+                    break;
+                }
+                have += k;
+            }
+            return true;
+        }
+};
+#endif
+
+class FASTAFile {
+    public:
+        // how the file is read:
+        //   Stream reads through a std::ifstream;
+        //   Mmap maps the whole file read-only, so lookups copy straight out of
+        //   the page cache (only available on POSIX systems).
+        enum class Backend { Stream, Mmap };
+
+        // how the file is compressed. Bgzf files allow random access when
+        // built with FASTA_USE_ZLIB; Gzip files can only be read in order.
+        using Compression = fasta_detail::Compression;
+
+        // Reverse gets the reverse complement of a region
+        enum class Strand { Forward, Reverse };
+
+        // bases start to end, inclusive, of the named record
+        struct Region {
+            std::string name;
+            std::size_t start = 0;
+            std::size_t end = 0;
+            Strand strand = Strand::Forward;
+        };
+
+        FASTAFile(): file("") {}
+        FASTAFile(const std::string& filename, Backend backend = Backend::Stream): file(filename) {
+            if (!open(filename, backend)) {
+                throw std::runtime_error("Error opening file: " + filename + "!");
+            }
+        }
+        explicit FASTAFile(std::shared_ptr<FASTAByteSource> src, std::shared_ptr<FASTAByteSource> fai = nullptr,
+                std::shared_ptr<FASTAByteSource> gzi = nullptr) {
+            std::string name = src ? src->name() : "";
+            if (!open(std::move(src), std::move(fai), std::move(gzi))) {
+                throw std::runtime_error("Error opening file: " + name + "!");
+            }
+        }
+
+        ~FASTAFile() { close(); }
+
+        // returns false if opening the file failed
+        // use this only if you used the default constructor.
+        // if a .fai index exists next to the file it is loaded as well, and
+        // a std::runtime_error is thrown if it is malformed.
+        // compressed files always use the Stream backend.
+        bool open(const std::string& filename, Backend backend = Backend::Stream) {
+            close();
+            file = filename;
+            compress = fasta_detail::detect_compression(file);
+            if (compress != Compression::None) {
+#ifdef FASTA_USE_ZLIB
+                backend = Backend::Stream;
+#else
+                return false;
+#endif
+            }
+            if (backend == Backend::Mmap) {
+                if (!map_file()) return false;
+            } else {
+                infile = std::ifstream(file, std::ios::binary);
+                if (!infile) return false;
+#ifdef FASTA_HAVE_POSIX
+                fd = ::open(file.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    infile.close();
+                    return false;
+                }
+#endif
+            }
+            mode = backend;
+#ifdef FASTA_USE_ZLIB
+            if (compress == Compression::Bgzf) {
+                bgzf.reset([this](std::uint64_t offset, char* dst, std::size_t n) {
+                    return raw_read_at(offset, dst, n);
+                });
+                if (!bgzf.load_gzi(file + ".gzi")) bgzf.build_gzi();
+            }
+#endif
+            std::ifstream fai(file + ".fai");
+            if (fai) {
+                try {
+                    load_index(fai);
+                } catch (...) {
+                    close();
+                    throw;
+                }
+            }
+            return true;
+        }
+
+        // opens a file read through src, loading the .fai index from fai
+        // and, for BGZF files, the block offsets from gzi when they are
+        // given. a source that holds the file in memory is read as with the
+        // Mmap backend. gzip files without BGZF blocks can't be opened this
+        // way. returns false if the file can't be used, and throws a
+        // std::runtime_error if the index is malformed.
+        bool open(std::shared_ptr<FASTAByteSource> src, std::shared_ptr<FASTAByteSource> fai = nullptr,
+                std::shared_ptr<FASTAByteSource> gzi = nullptr) {
+            close();
+            if (!src) return false;
+            file = src->name();
+            unsigned char h[18];
+            compress = fasta_detail::detect_compression(h, src->read_at(0, reinterpret_cast<char*>(h), sizeof(h)));
+#ifdef FASTA_USE_ZLIB
+            if (compress == Compression::Gzip) return false;
+#else
+            if (compress != Compression::None) return false;
+            (void)gzi;
+#endif
+            source = std::move(src);
+            if (source->data() && compress == Compression::None) {
+                map_data = source->data();
+                map_size = source->size();
+                mode = Backend::Mmap;
+            }
+#ifdef FASTA_USE_ZLIB
+            if (compress == Compression::Bgzf) {
+                bgzf.reset([this](std::uint64_t offset, char* dst, std::size_t n) {
+                    return raw_read_at(offset, dst, n);
+                });
+                if (gzi) {
+                    std::istringstream in(fasta_detail::read_all(*gzi));
+                    bgzf.load_gzi(in, gzi->name());
+                } else {
+                    bgzf.build_gzi();
+                }
+            }
+#endif
+            if (fai) {
+                try {
+                    std::istringstream in(fasta_detail::read_all(*fai));
+                    load_index(in);
+                } catch (...) {
+                    close();
+                    throw;
+                }
+            }
+            return true;
+        }
+
+#ifdef FASTA_HAVE_POSIX
+        // opens an http:// URL through a FASTAHttpSource, with the
+        // .fai (and .gzi) next to it if the server has them. reads go
+        // through a FASTACachedSource holding cache_bytes bytes, so
+        // neighbouring lookups share requests. headers are sent with every
+        // request. returns false if the file can't be used, and throws a
+        // std::runtime_error if the server can't be reached.
+        bool open_url(const std::string& url, std::size_t cache_bytes = 64 << 20,
+                const std::vector<std::string>& headers = {}) {
+            std::shared_ptr<FASTAByteSource> src = std::make_shared<FASTAHttpSource>(url, headers);
+            if (cache_bytes > 0) src = std::make_shared<FASTACachedSource>(src, cache_bytes);
+            return open(src, optional_url(url + ".fai", headers), optional_url(url + ".gzi", headers));
+        }
+#endif
+
+        // closes the file
+        void close() {
+            // let asynchronous lookups finish before the file goes away.
+            // their callbacks may start more, which go to a new pool, so
+            // this repeats until nothing is left. the lock isn't held while
+            // waiting, as the callbacks need it.
+            for (;;) {
+                std::unique_ptr<fasta_detail::ThreadPool> p;
+#ifdef FASTA_HAVE_IO_URING
+                std::unique_ptr<fasta_detail::UringReader> r;
+#endif
+                {
+                    std::lock_guard<std::mutex> lock(async_mutex);
+                    p = std::move(pool);
+#ifdef FASTA_HAVE_IO_URING
+                    r = std::move(ring);
+                    ring_tried = true;
+                    if (!p && !r) {
+                        ring_tried = false;
+                        break;
+                    }
+#else
+                    if (!p) break;
+#endif
+                }
+                // the pool first, as its lookups may still be reading
+                // through the ring
+                p.reset();
+#ifdef FASTA_HAVE_IO_URING
+                r.reset();
+#endif
+            }
+            infile.close();
+#ifdef FASTA_HAVE_POSIX
+            if (fd >= 0) ::close(fd);
+#endif
+            fd = -1;
+            // memory belonging to a source goes with it
+            if (source) {
+                map_data = nullptr;
+                map_size = 0;
+            }
+            source.reset();
+            unmap_file();
+            shared = false;
+            mode = Backend::Stream;
+            compress = Compression::None;
+            clear_index();
+        }
+
+        // the backend the file was opened with
+        Backend backend() const { return mode; }
+
+        // how the open file is compressed
+        Compression compression() const { return compress; }
+
+#ifdef FASTA_USE_ZLIB
+        // writes the BGZF block offsets of a Bgzf file in .gzi format.
+        // returns false on failure.
+        bool write_gzi(const std::string& filename) const {
+            return compress == Compression::Bgzf && bgzf.write_gzi(filename);
+        }
+#endif
+
+        // loads a samtools-compatible .fai index for the open file.
+        // returns false if the index could not be opened, and throws a
+        // std::runtime_error if it is malformed.
+        bool load_index(const std::string& filename) {
+            std::ifstream fai(filename);
+            if (!fai) return false;
+            load_index(fai);
+            return true;
+        }
+
+        // builds the index by scanning the whole file in large blocks.
+        // uncompressed files can be scanned on several threads (0 for one
+        // per core) where they can be memory-mapped. check runs validate()
+        // straight after, while the file is still in the page cache. throws
+        // a std::runtime_error if the file cannot be indexed.
+        void build_index(unsigned threads = 1, bool check = false) {
+            rebuild_index(threads);
+            if (check) validate(threads);
+        }
+
+        // checks every record of the file against the index, on threads
+        // threads (0 for one per core): that each line but the last holds
+        // line_bases bases followed by \n or \r\n, and that nothing but
+        // line endings comes between the last base and the next header.
+        // the bytes are classified as they go by, and each entry's
+        // alphabet, soft_masked and crlf are filled in, for this process
+        // only. lookups copy the lines of validated records without looking
+        // for stray line endings. returns false if any record holds bytes
+        // outside every alphabet, and throws a std::runtime_error if the
+        // file doesn't match the index. this is not thread-safe.
+        bool validate(unsigned threads = 1) {
+            ensure_index();
+            fasta_detail::parallel_for(threads, index_entries.size(), [&](std::size_t i) {
+                validate_record(index_entries[i]);
+            });
+            for (const auto& rec : index_entries) {
+                if (rec.alphabet == FASTAAlphabet::Invalid) return false;
+            }
+            return true;
+        }
+
+        // writes the loaded index in .fai format. returns false on failure.
+        bool write_index(const std::string& filename) const {
+            return fasta_detail::write_fai(filename, index_entries);
+        }
+
+        // true if sequence lookups can use the index
+        bool has_index() const { return indexed.load(std::memory_order_acquire); }
+
+        // the index entries, in file order. the index is built first if none
+        // has been loaded.
+        const std::vector<FASTAIndexEntry>& index() const {
+            ensure_index();
+            return index_entries;
+        }
+
+        // hit and miss counts of the block cache
+        struct CacheStats {
+            std::uint64_t hits = 0;
+            std::uint64_t misses = 0;
+            std::size_t blocks = 0; // blocks cached now
+            std::size_t bytes = 0;  // bytes of bases cached now
+        };
+
+        // caches the bases of indexed lookups in blocks of block_size bases
+        // each, keeping at most 'bytes' bytes of them. lookups then read the
+        // file only for blocks they don't find. a zero size turns the cache
+        // off. this is not thread-safe.
+        void enable_cache(std::size_t bytes, std::size_t block_size = 4096) {
+            cache.clear();
+            cache.set_capacity(bytes);
+            cache_block = bytes > 0 ? block_size : 0;
+        }
+
+        void disable_cache() { enable_cache(0); }
+
+        CacheStats cache_stats() const {
+            CacheStats st;
+            st.hits = cache.hits();
+            st.misses = cache.misses();
+            st.blocks = cache.count();
+            st.bytes = cache.bytes();
+            return st;
+        }
+
+        // what lookups have cost since the file was opened. apart from the
+        // cache counts these stay 0 unless built with FASTA_ENABLE_STATS,
+        // which keeps the counting out of the lookups altogether otherwise.
+        struct Stats {
+            std::uint64_t queries = 0;    // regions returned
+            std::uint64_t bases = 0;      // bases returned
+            std::uint64_t bytes_read = 0; // file bytes read, or copied out of the mapping
+            std::uint64_t reads = 0;      // positioned reads (seeks) of the file
+            std::uint64_t cache_hits = 0;
+            std::uint64_t cache_misses = 0;
+            std::uint64_t fetch_ns = 0;   // time spent in lookups
+            std::uint64_t index_ns = 0;   // time spent building indexes
+        };
+
+        Stats stats() const {
+            Stats st;
+#ifdef FASTA_ENABLE_STATS
+            st.queries = counters.queries.load(std::memory_order_relaxed);
+            st.bases = counters.bases.load(std::memory_order_relaxed);
+            st.bytes_read = counters.bytes_read.load(std::memory_order_relaxed);
+            st.reads = counters.reads.load(std::memory_order_relaxed);
+            st.fetch_ns = counters.fetch_ns.load(std::memory_order_relaxed);
+            st.index_ns = counters.index_ns.load(std::memory_order_relaxed);
+#endif
+            st.cache_hits = cache.hits();
+            st.cache_misses = cache.misses();
+            return st;
+        }
+
+        void reset_stats() {
+#ifdef FASTA_ENABLE_STATS
+            counters.reset();
+#endif
+        }
+
+        // called after every lookup, or get_sequences() batch, with its time
+        // in nanoseconds and the number of bases it returned, from the
+        // thread that ran it. only called when built with FASTA_ENABLE_STATS.
+        // set it before looking up sequences from other threads.
+        using LatencyHook = std::function<void(std::uint64_t, std::size_t)>;
+
+        void set_latency_hook(LatencyHook hook) {
+#ifdef FASTA_ENABLE_STATS
+            latency_hook = std::move(hook);
+#else
+            (void)hook;
+#endif
+        }
+
+        // reads every record in order, independently of get_sequence(). the
+        // file must stay open while the reader is used.
+        FASTAReader records() const {
+            if (shared) throw std::runtime_error("A shared store can't be read as FASTA: " + file);
+            if (mode == Backend::Mmap) return FASTAReader(map_data, map_size);
+            if (source) throw std::runtime_error("Reading every record needs a local file: " + file);
+            // FASTAReader decompresses the file itself
+            return FASTAReader(file);
+        }
+
+        // calls fn with the index entry and bases of every record, on up to
+        // threads threads (0 for one per core) that each take the next
+        // record, largest first, as they finish. fn may be called from
+        // several threads at once. the first exception from fn or a lookup
+        // stops the scan and is rethrown.
+        void for_each_record(const std::function<void(const FASTAIndexEntry&, const std::string&)>& fn,
+                unsigned threads = 0, bool caps = false) const {
+            ensure_index();
+            std::vector<const FASTAIndexEntry*> order;
+            for (const auto& r : index_entries) order.push_back(&r);
+            std::stable_sort(order.begin(), order.end(), [](const FASTAIndexEntry* a, const FASTAIndexEntry* b) {
+                return a->length > b->length;
+            });
+            fasta_detail::parallel_for(threads, order.size(), [&](std::size_t i) {
+                std::uint64_t t0 = query_start();
+                std::string seq(order[i]->length, '\0');
+                copy_bases(*order[i], 0, seq.size(), &seq[0], caps);
+                query_done(t0, 1, seq.size());
+                fn(*order[i], seq);
+            });
+        }
+
+        // reads every record into one FASTASequences block, on up to threads
+        // threads (0 for one per core). uncompressed files are mapped for the
+        // copy where possible; gzip files are read through once in order.
+        FASTASequences load_all(bool caps = false, unsigned threads = 1) const {
+            ensure_index();
+            FASTASequences ret;
+            ret.owned.reset(new char[FASTASequences::image_bytes(index_entries)]);
+            ret.base = ret.owned.get();
+            fill_image(ret.owned.get(), caps, threads);
+            return ret;
+        }
+
+#ifdef FASTA_HAVE_POSIX
+        // copies every record into the POSIX shared memory object name (such
+        // as "/hg38"), which must not exist yet, for other processes to open
+        // with open_shared(). returns false if it can't be created. the
+        // object stays until unlink_shared() or a reboot.
+        bool share(const std::string& name, bool caps = false, unsigned threads = 1) const {
+            ensure_index();
+            std::size_t bytes = FASTASequences::image_bytes(index_entries);
+            int shm = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (shm < 0) return false;
+            void* p = MAP_FAILED;
+            if (ftruncate(shm, bytes) == 0) {
+                p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+            }
+            ::close(shm);
+            if (p == MAP_FAILED) {
+                shm_unlink(name.c_str());
+                return false;
+            }
+            try {
+                fill_image(static_cast<char*>(p), caps, threads);
+            } catch (...) {
+                munmap(p, bytes);
+                shm_unlink(name.c_str());
+                throw;
+            }
+            munmap(p, bytes);
+            return true;
+        }
+
+        // attaches read-only to a store made by share(). every lookup works
+        // as with the Mmap backend, straight from the shared pages, with the
+        // index built in. records() is not available. returns false if there
+        // is no finished store of that name.
+        bool open_shared(const std::string& name) {
+            close();
+            int shm = shm_open(name.c_str(), O_RDONLY, 0);
+            if (shm < 0) return false;
+            struct stat st;
+            void* p = MAP_FAILED;
+            if (fstat(shm, &st) == 0 && st.st_size > 0) {
+                p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, shm, 0);
+            }
+            ::close(shm);
+            if (p == MAP_FAILED) return false;
+            if (!FASTASequences::valid_image(static_cast<const char*>(p), st.st_size)) {
+                munmap(p, st.st_size);
+                return false;
+            }
+            file = name;
+            map_data = static_cast<const char*>(p);
+            map_size = st.st_size;
+            mode = Backend::Mmap;
+            shared = true;
+            scan_index();
+            return true;
+        }
+
+        // removes a store made by share(). processes that have it open keep
+        // their mapping.
+        static bool unlink_shared(const std::string& name) {
+            return shm_unlink(name.c_str()) == 0;
+        }
+#endif
+
+        // true if the file is a store opened with open_shared()
+        bool is_shared() const { return shared; }
+
+        // returns the index entry for a record name, or nullptr if there is
+        // none. names are the header text up to the first whitespace.
+        // the index is built first if none has been loaded.
+        const FASTAIndexEntry* find_record(const std::string& name) const {
+            ensure_index();
+            auto it = record_lookup.find(name);
+            return it == record_lookup.end() ? nullptr : &index_entries[it->second];
+        }
+
+        // gets the bases from start to end, inclusive, of the named record.
+        // the index is built first if none has been loaded.
+        std::string get_sequence(const std::string& name, std::size_t start, std::size_t end, bool caps = false) const {
+            std::string ret;
+            get_sequence_into(ret, name, start, end, caps);
+            return ret;
+        }
+
+        // like get_sequence(name, start, end, caps), but stores the bases in
+        // out, reusing its storage. returns the number of bases.
+        std::size_t get_sequence_into(std::string& out, const std::string& name, std::size_t start,
+                std::size_t end, bool caps = false) const {
+            return get_sequence_into(out, name, start, end, Strand::Forward, caps);
+        }
+
+        // like get_sequence(name, start, end, caps), but writes the bases to
+        // dst, which must hold at least cap bytes. no terminator is added.
+        // returns the number of bases.
+        std::size_t get_sequence_into(char* dst, std::size_t cap, const std::string& name, std::size_t start,
+                std::size_t end, bool caps = false) const {
+            return get_sequence_into(dst, cap, name, start, end, Strand::Forward, caps);
+        }
+
+        // gets the bases of a region on either strand. the reverse strand is
+        // complemented as it is copied out, keeping IUPAC codes and case.
+        std::string get_sequence(const std::string& name, std::size_t start, std::size_t end, Strand strand,
+                bool caps = false) const {
+            std::string ret;
+            get_sequence_into(ret, name, start, end, strand, caps);
+            return ret;
+        }
+
+        std::size_t get_sequence_into(std::string& out, const std::string& name, std::size_t start,
+                std::size_t end, Strand strand, bool caps = false) const {
+            std::uint64_t t0 = query_start();
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            std::size_t n = end - start + 1;
+            out.resize(n);
+            copy_bases(rec, start - 1, n, &out[0], caps, strand == Strand::Reverse);
+            query_done(t0, 1, n);
+            return n;
+        }
+
+        std::size_t get_sequence_into(char* dst, std::size_t cap, const std::string& name, std::size_t start,
+                std::size_t end, Strand strand, bool caps = false) const {
+            std::uint64_t t0 = query_start();
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            std::size_t n = end - start + 1;
+            check_capacity(n, cap);
+            copy_bases(rec, start - 1, n, dst, caps, strand == Strand::Reverse);
+            query_done(t0, 1, n);
+            return n;
+        }
+
+        // gets the bases from start to end, inclusive, of the named record,
+        // passed through a compile-time FASTAPolicy. throws a
+        // std::runtime_error naming the base if ValidateIUPAC finds a bad one.
+        template <unsigned Policy>
+        std::string get_sequence(const std::string& name, std::size_t start, std::size_t end) const {
+            std::string ret;
+            get_sequence_into<Policy>(ret, name, start, end);
+            return ret;
+        }
+
+        template <unsigned Policy>
+        std::size_t get_sequence_into(std::string& out, const std::string& name, std::size_t start,
+                std::size_t end) const {
+            std::size_t n = range_length(start, end);
+            out.resize(n);
+            return get_sequence_into<Policy>(&out[0], n, name, start, end);
+        }
+
+        template <unsigned Policy>
+        std::size_t get_sequence_into(char* dst, std::size_t cap, const std::string& name, std::size_t start,
+                std::size_t end) const {
+            std::uint64_t t0 = query_start();
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            std::size_t n = end - start + 1;
+            check_capacity(n, cap);
+            const bool reverse = Policy & FASTAPolicy::ReverseComplement;
+
+            // pieces small enough to translate while still in cache
+            const std::size_t piece = 1 << 16;
+            for (std::size_t done = 0; done < n; done += piece) {
+                std::size_t k = std::min(piece, n - done);
+                char* out = reverse ? dst + n - done - k : dst + done;
+                copy_bases(rec, start - 1 + done, k, out, false, reverse);
+                if (!fasta_detail::PolicyTable<Policy>::active) continue;
+                std::size_t bad = fasta_detail::apply_policy<Policy>(out, k);
+                if (bad < k) {
+                    std::size_t pos = reverse ? start - 1 + done + (k - 1 - bad) : start - 1 + done + bad;
+                    char c;
+                    copy_bases(rec, pos, 1, &c, false);
+                    throw std::runtime_error("Invalid base '" + std::string(1, c) + "' at position "
+                        + std::to_string(pos + 1) + " of record " + name);
+                }
+            }
+            query_done(t0, 1, n);
+            return n;
+        }
+
+        // gets the bases from start to end, inclusive, of the named record
+        // without copying them when possible. with the Mmap backend a region
+        // on a single line is returned as a view into the mapping; otherwise
+        // the bases are copied into buf, which must hold at least cap bytes,
+        // and a view of buf is returned. the view is valid until the file is
+        // closed or buf is reused.
+        std::string_view get_sequence_view(const std::string& name, std::size_t start, std::size_t end,
+                char* buf, std::size_t cap) const {
+            std::uint64_t t0 = query_start();
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            std::size_t n = end - start + 1;
+            if (mode == Backend::Mmap) {
+                std::uint64_t first = rec.byte_offset(start - 1);
+                if (rec.byte_offset(end - 1) - first + 1 == n) {
+                    query_done(t0, 1, n);
+                    return std::string_view(map_data + first, n);
+                }
+            }
+            check_capacity(n, cap);
+            copy_bases(rec, start - 1, n, buf, false);
+            query_done(t0, 1, n);
+            return std::string_view(buf, n);
+        }
+
+        // called with either an error or the bases of an asynchronous lookup
+        using AsyncCallback = std::function<void(std::exception_ptr, std::string)>;
+
+        // gets the bases like get_sequence(name, start, end, caps) without
+        // blocking. on Linux, reads of uncompressed files go through io_uring
+        // when the kernel allows it; other lookups run on a thread pool.
+        std::future<std::string> get_sequence_async(const std::string& name, std::size_t start, std::size_t end,
+                bool caps = false) const {
+            auto promise = std::make_shared<std::promise<std::string>>();
+            std::future<std::string> ret = promise->get_future();
+            get_sequence_async(name, start, end, caps, [promise](std::exception_ptr err, std::string seq) {
+                if (err) {
+                    promise->set_exception(err);
+                } else {
+                    promise->set_value(std::move(seq));
+                }
+            });
+            return ret;
+        }
+
+        // like get_sequence_async(name, start, end, caps), but calls done on
+        // an internal thread when the lookup finishes, so done should be
+        // quick and must not throw. bad coordinates call done right away.
+        // done may start more lookups, but must not close the file.
+        void get_sequence_async(const std::string& name, std::size_t start, std::size_t end, bool caps,
+                AsyncCallback done) const {
+            const FASTAIndexEntry* rec;
+            try {
+                rec = &checked_record(name, start, end);
+            } catch (...) {
+                done(std::current_exception(), std::string());
+                return;
+            }
+            std::size_t pos = start - 1;
+            std::size_t n = end - start + 1;
+            std::uint64_t t0 = query_start();
+
+#ifdef FASTA_HAVE_IO_URING
+            fasta_detail::UringReader* ring = nullptr;
+            // a completion can't wait for room in the ring it is running on,
+            // so lookups it starts go to the pool
+            if (mode == Backend::Stream && compress == Compression::None && cache_block == 0 && fd >= 0
+                    && !fasta_detail::UringReader::reaping()) {
+                ring = async_ring();
+            }
+            if (ring) {
+                std::uint64_t first = rec->byte_offset(pos);
+                std::size_t len = rec->byte_offset(pos + n - 1) - first + 1;
+                count_read(len);
+                try {
+                    ring->read(fd, first, len, [this, rec, pos, n, caps, done, t0](long res, std::vector<char>& buf) {
+                        if (res < 0 || static_cast<std::size_t>(res) != buf.size()) {
+                            done(std::make_exception_ptr(std::runtime_error(res < 0
+                                ? "Error reading file: " + std::string(std::strerror(-res))
+                                : "End coordinate out of bounds")), std::string());
+                            return;
+                        }
+                        std::string seq(n, '\0');
+                        std::size_t col = pos % rec->line_bases;
+                        char* out = &seq[0];
+                        try {
+                            strip_lines(*rec, buf.data(), buf.size(), col, out, caps);
+                        } catch (...) {
+                            done(std::current_exception(), std::string());
+                            return;
+                        }
+                        query_done(t0, 1, n);
+                        done(nullptr, std::move(seq));
+                    });
+                } catch (...) {
+                    done(std::current_exception(), std::string());
+                }
+                return;
+            }
+#endif
+            async_pool()->submit([this, rec, pos, n, caps, done, t0] {
+                std::string seq(n, '\0');
+                try {
+                    copy_bases(*rec, pos, n, &seq[0], caps);
+                } catch (...) {
+                    done(std::current_exception(), std::string());
+                    return;
+                }
+                query_done(t0, 1, n);
+                done(nullptr, std::move(seq));
+            });
+        }
+
+        // gets many regions at once, returning their bases in the same order.
+        // the reads are sorted by file offset and overlapping or nearby ones
+        // are merged, so the file is read in one forward sweep.
+        std::vector<std::string> get_sequences(const Region* regions, std::size_t count, bool caps = false) const {
+            struct Piece {
+                const FASTAIndexEntry* rec;
+                std::size_t pos;
+                std::uint64_t first;
+                std::uint64_t last;
+                std::size_t idx;
+                bool reverse;
+            };
+
+            std::uint64_t t0 = query_start();
+            std::size_t total = 0;
+            std::vector<std::string> ret(count);
+            std::vector<Piece> pieces(count);
+            for (std::size_t i = 0; i < count; i++) {
+                const Region& r = regions[i];
+                const FASTAIndexEntry& rec = checked_record(r.name, r.start, r.end);
+                pieces[i] = {&rec, r.start - 1, rec.byte_offset(r.start - 1), rec.byte_offset(r.end - 1), i,
+                    r.strand == Strand::Reverse};
+                ret[i].resize(r.end - r.start + 1);
+                total += ret[i].size();
+            }
+            std::sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) {
+                return a.first < b.first;
+            });
+
+            std::vector<char> buf;
+            for (std::size_t i = 0; i < count;) {
+                // grow the read while the next piece starts close enough
+                std::uint64_t first = pieces[i].first;
+                std::uint64_t last = pieces[i].last;
+                std::size_t j = i + 1;
+                while (j < count && pieces[j].first <= last + 1 + FASTA_COALESCE_GAP
+                        && std::max(last, pieces[j].last) - first < FASTA_BLOCK_SIZE) {
+                    last = std::max(last, pieces[j].last);
+                    j++;
+                }
+
+                const char* data;
+                if (mode == Backend::Mmap) {
+                    if (last >= map_size) {
+                        throw std::runtime_error("End coordinate out of bounds");
+                    }
+                    data = map_data + first;
+                    count_read(last - first + 1, false);
+                } else {
+                    buf.resize(last - first + 1);
+                    if (read_at(first, buf.data(), buf.size()) != buf.size()) {
+                        throw std::runtime_error("End coordinate out of bounds");
+                    }
+                    data = buf.data();
+                }
+
+                for (; i < j; i++) {
+                    const Piece& p = pieces[i];
+                    std::size_t col = p.pos % p.rec->line_bases;
+                    std::string& seq = ret[p.idx];
+                    char* out = p.reverse ? &seq[0] + seq.size() : &seq[0];
+                    strip_lines(*p.rec, data + (p.first - first), p.last - p.first + 1, col, out, caps, p.reverse);
+                }
+            }
+            query_done(t0, count, total);
+            return ret;
+        }
+
+        std::vector<std::string> get_sequences(const std::vector<Region>& regions, bool caps = false) const {
+            return get_sequences(regions.data(), regions.size(), caps);
+        }
+
+#ifdef FASTA_HAVE_SPAN
+        std::vector<std::string> get_sequences(std::span<const Region> regions, bool caps = false) const {
+            return get_sequences(regions.data(), regions.size(), caps);
+        }
+#endif
+
+        // gets a string of nucleotides from start to end, inclusive;
+        // so specifying 1, 2 would get 2nt
+        // 'caps' defaults to false. If specified, this uppercases all nucleotides
+        // records are treated as one concatenated coordinate space, and only
+        // the needed bytes are read. the index is built first if none has
+        // been loaded.
+        std::string get_sequence(std::size_t start, std::size_t end, bool caps = false) const {
+            std::string ret;
+            get_sequence_into(ret, start, end, caps);
+            return ret;
+        }
+
+        // like get_sequence(start, end, caps), but stores the bases in out,
+        // reusing its storage. returns the number of bases.
+        std::size_t get_sequence_into(std::string& out, std::size_t start, std::size_t end, bool caps = false) const {
+            std::uint64_t t0 = query_start();
+            std::size_t n = range_length(start, end);
+            out.resize(n);
+            global_bases(&out[0], start, n, caps);
+            query_done(t0, 1, n);
+            return n;
+        }
+
+        // like get_sequence(start, end, caps), but writes the bases to dst,
+        // which must hold at least cap bytes. no terminator is added.
+        // returns the number of bases.
+        std::size_t get_sequence_into(char* dst, std::size_t cap, std::size_t start, std::size_t end,
+                bool caps = false) const {
+            std::uint64_t t0 = query_start();
+            std::size_t n = range_length(start, end);
+            check_capacity(n, cap);
+            global_bases(dst, start, n, caps);
+            query_done(t0, 1, n);
+            return n;
+        }
+
+        // a region of a record that is only decoded when it is read.
+        // substr() and copying are O(1) and never allocate; single bases
+        // come straight from the mapping with the Mmap backend, or from a
+        // small window of decoded bases otherwise, through the block cache
+        // if it is on. the file must stay open and keep its index while a
+        // view is used, and one view shouldn't be read from several threads.
+        class SequenceView {
+            public:
+                static constexpr std::size_t npos = std::size_t(-1);
+
+                // bases are decoded as they are read, so dereferencing gives
+                // a char rather than a reference into the view. that makes
+                // this an input iterator, though it can be copied and read
+                // again like a forward one.
+                class const_iterator {
+                    public:
+                        using iterator_category = std::input_iterator_tag;
+                        using value_type = char;
+                        using difference_type = std::ptrdiff_t;
+                        using pointer = const char*;
+                        using reference = char;
+
+                        const_iterator() = default;
+                        const_iterator(const SequenceView* v, std::size_t i): view(v), idx(i) {}
+
+                        char operator*() const { return (*view)[idx]; }
+                        const_iterator& operator++() {
+                            idx++;
+                            return *this;
+                        }
+                        const_iterator operator++(int) {
+                            const_iterator old = *this;
+                            idx++;
+                            return old;
+                        }
+                        bool operator==(const const_iterator& o) const { return idx == o.idx && view == o.view; }
+                        bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+                    private:
+                        const SequenceView* view = nullptr;
+                        std::size_t idx = 0;
+                };
+
+                SequenceView() = default;
+
+                std::size_t size() const { return len; }
+                std::size_t length() const { return len; }
+                bool empty() const { return len == 0; }
+
+                // the record name, empty for a default view, and the 1-based
+                // inclusive coordinates
+                const std::string& name() const {
+                    static const std::string none;
+                    return rec ? rec->name : none;
+                }
+                std::size_t start() const { return pos + 1; }
+                std::size_t stop() const { return pos + len; }
+
+                char operator[](std::size_t i) const {
+                    std::size_t p = pos + i;
+                    if (file->mode == Backend::Mmap) return file->map_data[rec->byte_offset(p)];
+                    if (p < win_pos || p >= win_pos + win_len) {
+                        win_pos = p;
+                        win_len = std::min(sizeof(win), pos + len - p);
+                        file->copy_bases(*rec, p, win_len, win, false);
+                    }
+                    return win[p - win_pos];
+                }
+
+                char at(std::size_t i) const {
+                    if (i >= len) throw std::out_of_range("SequenceView index out of range");
+                    return (*this)[i];
+                }
+
+                const_iterator begin() const { return const_iterator(this, 0); }
+                const_iterator end() const { return const_iterator(this, len); }
+
+                // count bases from offset on, clamped like std::string::substr.
+                // throws std::out_of_range if offset is past the end.
+                SequenceView substr(std::size_t offset, std::size_t count = npos) const {
+                    if (offset > len) throw std::out_of_range("SequenceView offset out of range");
+                    return SequenceView(file, rec, pos + offset, std::min(count, len - offset));
+                }
+
+                // decodes n bases from offset on into dst and returns n
+                std::size_t copy(char* dst, std::size_t n, std::size_t offset = 0, bool caps = false) const {
+                    if (offset > len) throw std::out_of_range("SequenceView offset out of range");
+                    n = std::min(n, len - offset);
+                    file->copy_bases(*rec, pos + offset, n, dst, caps);
+                    return n;
+                }
+
+                std::string str(bool caps = false) const {
+                    std::string ret(len, '\0');
+                    copy(&ret[0], len, 0, caps);
+                    return ret;
+                }
+
+                // compares like std::string_view::compare, decoding in pieces
+                int compare(std::string_view s) const {
+                    char tmp[256];
+                    std::size_t n = std::min(len, s.size());
+                    for (std::size_t i = 0; i < n; i += sizeof(tmp)) {
+                        std::size_t k = std::min(sizeof(tmp), n - i);
+                        copy(tmp, k, i);
+                        int c = std::memcmp(tmp, s.data() + i, k);
+                        if (c) return c < 0 ? -1 : 1;
+                    }
+                    return len < s.size() ? -1 : len > s.size() ? 1 : 0;
+                }
+
+                int compare(const SequenceView& o) const {
+                    char a[256], b[256];
+                    std::size_t n = std::min(len, o.len);
+                    for (std::size_t i = 0; i < n; i += sizeof(a)) {
+                        std::size_t k = std::min(sizeof(a), n - i);
+                        copy(a, k, i);
+                        o.copy(b, k, i);
+                        int c = std::memcmp(a, b, k);
+                        if (c) return c < 0 ? -1 : 1;
+                    }
+                    return len < o.len ? -1 : len > o.len ? 1 : 0;
+                }
+
+                friend bool operator==(const SequenceView& a, std::string_view b) {
+                    return a.size() == b.size() && a.compare(b) == 0;
+                }
+                friend bool operator==(std::string_view a, const SequenceView& b) { return b == a; }
+                friend bool operator!=(const SequenceView& a, std::string_view b) { return !(a == b); }
+                friend bool operator!=(std::string_view a, const SequenceView& b) { return !(b == a); }
+                friend bool operator<(const SequenceView& a, std::string_view b) { return a.compare(b) < 0; }
+                friend bool operator==(const SequenceView& a, const SequenceView& b) {
+                    return a.size() == b.size() && a.compare(b) == 0;
+                }
+                friend bool operator!=(const SequenceView& a, const SequenceView& b) { return !(a == b); }
+                friend bool operator<(const SequenceView& a, const SequenceView& b) { return a.compare(b) < 0; }
+
+            private:
+                friend class FASTAFile;
+
+                SequenceView(const FASTAFile* f, const FASTAIndexEntry* r, std::size_t p, std::size_t n):
+                    file(f), rec(r), pos(p), len(n) {}
+
+                const FASTAFile* file = nullptr;
+                const FASTAIndexEntry* rec = nullptr;
+                std::size_t pos = 0; // 0-based start in the record
+                std::size_t len = 0;
+
+                // the last bases decoded for operator[] without a mapping
+                mutable char win[64];
+                mutable std::size_t win_pos = 0;
+                mutable std::size_t win_len = 0;
+        };
+
+        // a lazy view of bases start to end, inclusive, of the named record.
+        // nothing is read until the view is.
+        SequenceView view(const std::string& name, std::size_t start, std::size_t end) const {
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            if (mode == Backend::Mmap && rec.byte_offset(end - 1) >= map_size) {
+                throw std::runtime_error("End coordinate out of bounds");
+            }
+            return SequenceView(this, &rec, start - 1, end - start + 1);
+        }
+
+        // a lazy view of a whole record
+        SequenceView view(const std::string& name) const {
+            ensure_index();
+            const FASTAIndexEntry& rec = lookup(name);
+            if (rec.length == 0) return SequenceView(this, &rec, 0, 0);
+            return view(name, 1, rec.length);
+        }
+
+        // reads one record front to back, such as in sliding windows. bases
+        // are decoded readahead at a time into a buffer that later lookups
+        // are served from, and the OS is told to fetch the next stretch of
+        // the file while the current one is used. going backwards works, but
+        // rereads. the file must stay open while the cursor is used.
+        class Cursor {
+            public:
+                Cursor() = default;
+
+                // the record's name and length, empty for a default cursor
+                const std::string& name() const {
+                    static const std::string none;
+                    return rec ? rec->name : none;
+                }
+                std::size_t length() const { return rec ? rec->length : 0; }
+
+                // the bases from start to end, inclusive, of the record
+                std::string get_sequence(std::size_t start, std::size_t end, bool caps = false) {
+                    std::string ret;
+                    get_sequence_into(ret, start, end, caps);
+                    return ret;
+                }
+
+                std::size_t get_sequence_into(std::string& out, std::size_t start, std::size_t end,
+                        bool caps = false) {
+                    std::size_t n = range_length(start, end);
+                    if (end > length()) throw std::runtime_error("End coordinate out of bounds");
+                    out.resize(n);
+                    std::size_t pos = start - 1;
+                    if (pos < buf_pos || pos + n > buf_pos + buf_len) fill(pos, n);
+                    const char* src = buf.data() + (pos - buf_pos);
+                    if (caps) {
+                        fasta_strip_copy(&out[0], src, n, true);
+                    } else {
+                        std::memcpy(&out[0], src, n);
+                    }
+                    return n;
+                }
+
+                // the next window of window bases, starting at base 1 and then
+                // step bases further each call. returns false once a whole
+                // window no longer fits in the record.
+                bool next_window(std::string& out, std::size_t window, std::size_t step, bool caps = false) {
+                    if (window == 0 || step == 0) throw std::runtime_error("Invalid window");
+                    std::size_t start = started ? last + step : 1;
+                    if (start - 1 + window > length() || start < last) return false;
+                    get_sequence_into(out, start, start + window - 1, caps);
+                    started = true;
+                    last = start;
+                    return true;
+                }
+
+            private:
+                friend class FASTAFile;
+
+                Cursor(const FASTAFile* f, const FASTAIndexEntry* r, std::size_t ahead):
+                    file(f), rec(r), readahead(std::max<std::size_t>(ahead, 1)) {
+                    if (rec->length > 0) {
+                        std::uint64_t first = rec->offset;
+                        file->advise(first, rec->byte_offset(rec->length - 1) - first + 1, true);
+                    }
+                }
+
+                const FASTAFile* file = nullptr;
+                const FASTAIndexEntry* rec = nullptr;
+                std::size_t readahead = 0; // bases decoded per fill
+                std::vector<char> buf;
+                std::size_t buf_pos = 0; // 0-based record position of buf[0]
+                std::size_t buf_len = 0;
+                bool started = false;
+                std::size_t last = 0; // start of the last window
+
+                // decodes from pos on, at least n bases, and hints at the next
+                // stretch
+                void fill(std::size_t pos, std::size_t n) {
+                    std::size_t k = std::min(std::max(readahead, n), rec->length - pos);
+                    buf.resize(k);
+                    file->copy_bases(*rec, pos, k, buf.data(), false);
+                    buf_pos = pos;
+                    buf_len = k;
+
+                    std::size_t next = pos + k;
+                    if (next < rec->length) {
+                        std::size_t m = std::min(readahead, rec->length - next);
+                        std::uint64_t first = rec->byte_offset(next);
+                        file->advise(first, rec->byte_offset(next + m - 1) - first + 1, false);
+                    }
+                }
+        };
+
+        // a cursor over the named record, decoding readahead bases at a time
+        Cursor cursor(const std::string& name, std::size_t readahead = 1 << 20) const {
+            ensure_index();
+            return Cursor(this, &lookup(name), readahead);
+        }
+
+        // a k-mer of up to 32 bases, two bits a base with the last base in
+        // the lowest bits: A=0, C=1, G=2, T=3
+        struct Kmer {
+            std::uint64_t forward = 0;
+            std::uint64_t reverse = 0; // the reverse complement
+            std::size_t pos = 0;       // 1-based start in the record
+
+            // the smaller of the two strands, the same for either
+            std::uint64_t canonical() const { return std::min(forward, reverse); }
+        };
+
+        // the k-mers of a record or region in order, decoded straight from
+        // the mapping or from large reads of the file. k-mers with anything
+        // but A, C, G or T in them are skipped. the file must stay open
+        // while the reader is used.
+        class KmerReader {
+            public:
+                KmerReader() = default;
+
+                unsigned k() const { return kmer_len; }
+
+                // the record's name, empty for a default reader
+                const std::string& name() const {
+                    static const std::string none;
+                    return rec ? rec->name : none;
+                }
+
+                // the next k-mer. returns false after the last one.
+                bool next(Kmer& out) {
+                    return run([&](std::uint64_t f, std::uint64_t r, std::size_t pos) {
+                        out.forward = f;
+                        out.reverse = r;
+                        out.pos = pos;
+                        return false;
+                    });
+                }
+
+                // writes up to max of the next k-mers to words, canonical or
+                // forward, and their positions to positions unless it is
+                // null. returns how many were written, 0 after the last.
+                std::size_t next_batch(std::uint64_t* words, std::size_t max, std::size_t* positions = nullptr,
+                        bool canonical = true) {
+                    std::size_t n = 0;
+                    if (max == 0) return 0;
+                    run([&](std::uint64_t f, std::uint64_t r, std::size_t pos) {
+                        words[n] = canonical ? std::min(f, r) : f;
+                        if (positions) positions[n] = pos;
+                        return ++n < max;
+                    });
+                    return n;
+                }
+
+            private:
+                friend class FASTAFile;
+
+                // bytes taken from the file at a time
+                static constexpr std::size_t CHUNK = 1 << 20;
+
+                KmerReader(const FASTAFile* f, const FASTAIndexEntry* r, std::size_t start, std::size_t end,
+                        unsigned k):
+                    file(f), rec(r), kmer_len(k), pos(start - 1) {
+                    if (k == 0 || k > 32) throw std::runtime_error("Invalid k-mer length " + std::to_string(k));
+                    mask = k == 32 ? ~std::uint64_t(0) : (std::uint64_t(1) << (2 * k)) - 1;
+                    shift = 2 * (k - 1);
+                    next_byte = rec->byte_offset(start - 1);
+                    end_byte = rec->byte_offset(end - 1) + 1;
+                    file->advise(next_byte, end_byte - next_byte, true);
+                }
+
+                const FASTAFile* file = nullptr;
+                const FASTAIndexEntry* rec = nullptr;
+                unsigned kmer_len = 0;
+                unsigned shift = 0;
+                std::uint64_t mask = 0;
+                std::uint64_t fwd = 0;
+                std::uint64_t rev = 0;
+                unsigned valid = 0;  // bases in a row that are ACGT, up to k
+                std::size_t pos = 0; // bases consumed, as a 0-based position
+                std::uint64_t next_byte = 0; // file bytes not yet taken
+                std::uint64_t end_byte = 0;
+                std::vector<char> buf;
+                const unsigned char* p = nullptr;
+                const unsigned char* stop = nullptr;
+
+                // takes the next chunk of the region, and hints at the one
+                // after it. returns false at the end.
+                bool refill() {
+                    if (next_byte == end_byte) return false;
+                    std::uint64_t len = std::min<std::uint64_t>(CHUNK, end_byte - next_byte);
+                    p = reinterpret_cast<const unsigned char*>(file->raw_bytes(next_byte, len, buf));
+                    stop = p + len;
+                    next_byte += len;
+                    if (next_byte < end_byte) {
+                        file->advise(next_byte, std::min<std::uint64_t>(CHUNK, end_byte - next_byte), false);
+                    }
+                    return true;
+                }
+
+                // rolls both words over the bases, calling emit(forward,
+                // reverse, pos) for each whole k-mer until it returns false.
+                // returns false once the region is finished.
+                template <typename Emit>
+                bool run(Emit&& emit) {
+                    const auto& table = fasta_detail::kmer_table;
+                    for (;;) {
+                        if (p == stop && !refill()) return false;
+                        std::uint64_t f = fwd;
+                        std::uint64_t r = rev;
+                        unsigned v = valid;
+                        std::size_t at = pos;
+                        const unsigned char* q = p;
+                        bool more = true;
+                        while (more && q < stop) {
+                            unsigned char c = table[*q++];
+                            if (c >= fasta_detail::KMER_SKIP) {
+                                if (c == fasta_detail::KMER_BREAK) {
+                                    v = 0;
+                                    at++;
+                                }
+                                continue;
+                            }
+                            at++;
+                            f = ((f << 2) | c) & mask;
+                            r = (r >> 2) | (std::uint64_t(3 - c) << shift);
+                            v += v < kmer_len;
+                            if (v == kmer_len) more = emit(f, r, at - kmer_len + 1);
+                        }
+                        fwd = f;
+                        rev = r;
+                        valid = v;
+                        pos = at;
+                        p = q;
+                        if (!more) return true;
+                    }
+                }
+        };
+
+        // the k-mers, for k up to 32, of the bases from start to end,
+        // inclusive, of the named record
+        KmerReader kmers(const std::string& name, std::size_t start, std::size_t end, unsigned k) const {
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            return KmerReader(this, &rec, start, end, k);
+        }
+
+        // the k-mers of a whole record
+        KmerReader kmers(const std::string& name, unsigned k) const {
+            ensure_index();
+            const FASTAIndexEntry& rec = lookup(name);
+            if (rec.length == 0) return KmerReader();
+            return KmerReader(this, &rec, 1, rec.length, k);
+        }
+
+        // base counts of a region. bases other than A, C, G, T and N, of
+        // either case, count as other; lower counts the soft-masked bases.
+        struct Composition {
+            std::uint64_t a = 0;
+            std::uint64_t c = 0;
+            std::uint64_t g = 0;
+            std::uint64_t t = 0;
+            std::uint64_t n = 0;
+            std::uint64_t other = 0;
+            std::uint64_t lower = 0;
+            std::uint64_t length = 0;
+
+            // G and C over A, C, G and T, so gaps don't count
+            double gc_fraction() const {
+                std::uint64_t acgt = a + c + g + t;
+                return acgt ? double(g + c) / acgt : 0.0;
+            }
+
+            double n_fraction() const { return length ? double(n) / length : 0.0; }
+
+            double masked_fraction() const { return length ? double(lower) / length : 0.0; }
+        };
+
+        // counts the bases from start to end, inclusive, of the named
+        // record. the file's bytes are counted where they lie, so the bases
+        // are never copied out; with a composition index only the ends of
+        // the region are read.
+        Composition composition(const std::string& name, std::size_t start, std::size_t end) const {
+            std::uint64_t t0 = query_start();
+            const FASTAIndexEntry& rec = checked_record(name, start, end);
+            std::uint64_t counts[fasta_detail::COUNT_KINDS] = {};
+            std::size_t pos = start - 1;
+            std::size_t n = end - start + 1;
+            std::size_t r = &rec - index_entries.data();
+            std::size_t block = comp_block;
+            std::size_t b0 = block ? (pos + block - 1) / block : 0;
+            std::size_t b1 = block ? (pos + n) / block : 0;
+            if (b0 < b1) {
+                const std::uint64_t* lo = &comp_prefix[(comp_first[r] + b0) * fasta_detail::COUNT_KINDS];
+                const std::uint64_t* hi = &comp_prefix[(comp_first[r] + b1) * fasta_detail::COUNT_KINDS];
+                for (int k = 0; k < fasta_detail::COUNT_KINDS; k++) counts[k] = hi[k] - lo[k];
+                count_range(rec, pos, b0 * block - pos, counts);
+                count_range(rec, b1 * block, pos + n - b1 * block, counts);
+            } else {
+                count_range(rec, pos, n, counts);
+            }
+            query_done(t0, 1, n);
+            return make_composition(counts, n);
+        }
+
+        Composition composition(const std::string& name) const {
+            ensure_index();
+            const FASTAIndexEntry& rec = lookup(name);
+            if (rec.length == 0) return Composition();
+            return composition(name, 1, rec.length);
+        }
+
+        // keeps running counts at every block_size bases of every record,
+        // so composition() takes the same time for a region of any length.
+        // this costs 48 bytes per block and one pass over the file, on
+        // several threads if asked (0 for one per core). this is not
+        // thread-safe.
+        void build_composition_index(std::size_t block_size = 4096, unsigned threads = 1) {
+            drop_composition_index();
+            if (block_size == 0) return;
+            ensure_index();
+            std::vector<std::size_t> first(index_entries.size());
+            std::size_t total = 0;
+            for (std::size_t r = 0; r < index_entries.size(); r++) {
+                first[r] = total;
+                total += index_entries[r].length / block_size + 1;
+            }
+            std::vector<std::uint64_t> prefix(total * fasta_detail::COUNT_KINDS);
+            fasta_detail::parallel_for(threads, index_entries.size(), [&](std::size_t r) {
+                const FASTAIndexEntry& rec = index_entries[r];
+                std::uint64_t* p = &prefix[first[r] * fasta_detail::COUNT_KINDS];
+                std::uint64_t counts[fasta_detail::COUNT_KINDS] = {};
+                std::vector<char> buf;
+                // whole blocks are counted a large read at a time
+                std::size_t piece = std::max<std::size_t>(1, (1 << 20) / block_size) * block_size;
+                for (std::size_t pos = 0; pos + block_size <= rec.length; pos += piece) {
+                    std::size_t m = std::min(piece, rec.length / block_size * block_size - pos);
+                    std::uint64_t base = rec.byte_offset(pos);
+                    const char* bytes = raw_bytes(base, rec.byte_offset(pos + m - 1) - base + 1, buf);
+                    for (std::size_t b = pos; b < pos + m; b += block_size) {
+                        std::uint64_t at = rec.byte_offset(b);
+                        fasta_detail::count_bases(bytes + (at - base), rec.byte_offset(b + block_size - 1) - at + 1,
+                            counts);
+                        p += fasta_detail::COUNT_KINDS;
+                        std::copy(counts, counts + fasta_detail::COUNT_KINDS, p);
+                    }
+                }
+            });
+            comp_prefix = std::move(prefix);
+            comp_first = std::move(first);
+            comp_block = block_size;
+        }
+
+        // frees the composition index. this is not thread-safe.
+        void drop_composition_index() {
+            comp_block = 0;
+            comp_prefix.clear();
+            comp_prefix.shrink_to_fit();
+            comp_first.clear();
+        }
+
+    private:
+        std::string file;
+        Backend mode = Backend::Stream;
+        Compression compress = Compression::None;
+#ifdef FASTA_USE_ZLIB
+        fasta_detail::BGZFReader bgzf;
+#endif
+        int fd = -1; // read with pread, so there is no shared file position
+        std::shared_ptr<FASTAByteSource> source; // used instead of fd when set
+        const char* map_data = nullptr;
+        std::size_t map_size = 0;
+        bool shared = false; // map_data is a FASTASequences block from open_shared()
+
+        // the index can be built lazily by const lookups, under index_mutex
+        mutable std::mutex index_mutex;
+        mutable std::atomic<bool> indexed{false};
+        mutable std::vector<FASTAIndexEntry> index_entries;
+        mutable std::vector<std::size_t> record_starts; // first global position of each record
+        mutable std::unordered_map<std::string, std::size_t> record_lookup;
+
+        // decoded blocks of bases, keyed by record and block number
+        struct BlockKey {
+            std::size_t record;
+            std::size_t block;
+            bool operator==(const BlockKey& o) const { return record == o.record && block == o.block; }
+        };
+        struct BlockKeyHash {
+            std::size_t operator()(const BlockKey& k) const {
+                return std::hash<std::uint64_t>()((std::uint64_t(k.record) << 40) ^ k.block);
+            }
+        };
+        fasta_detail::BlockCache<BlockKey, BlockKeyHash> cache;
+        std::size_t cache_block = 0; // bases per cached block, or 0 if off
+
+        // running base counts at every comp_block bases of each record,
+        // COUNT_KINDS to an entry; record r's start at entry comp_first[r]
+        mutable std::vector<std::uint64_t> comp_prefix;
+        mutable std::vector<std::size_t> comp_first;
+        mutable std::size_t comp_block = 0; // or 0 if there is no composition index
+
+#ifdef FASTA_ENABLE_STATS
+        struct Counters {
+            std::atomic<std::uint64_t> queries{0};
+            std::atomic<std::uint64_t> bases{0};
+            std::atomic<std::uint64_t> bytes_read{0};
+            std::atomic<std::uint64_t> reads{0};
+            std::atomic<std::uint64_t> fetch_ns{0};
+            std::atomic<std::uint64_t> index_ns{0};
+
+            void reset() {
+                for (auto* c : {&queries, &bases, &bytes_read, &reads, &fetch_ns, &index_ns}) c->store(0);
+            }
+        };
+        mutable Counters counters;
+        LatencyHook latency_hook;
+#endif
+
+        // runs asynchronous lookups; created on first use
+        mutable std::mutex async_mutex;
+        mutable std::unique_ptr<fasta_detail::ThreadPool> pool;
+#ifdef FASTA_HAVE_IO_URING
+        mutable std::unique_ptr<fasta_detail::UringReader> ring;
+        mutable bool ring_tried = false;
+#endif
+
+        // systems without pread share one stream
+        mutable std::mutex stream_mutex;
+        mutable std::ifstream infile;
+
+        void clear_index() const {
+            indexed.store(false, std::memory_order_release);
+            cache.clear();
+            index_entries.clear();
+            record_starts.clear();
+            record_lookup.clear();
+            comp_block = 0;
+            comp_prefix.clear();
+            comp_first.clear();
+        }
+
+        // the start of a timed lookup. these compile to nothing without
+        // FASTA_ENABLE_STATS.
+        std::uint64_t query_start() const {
+#ifdef FASTA_ENABLE_STATS
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+            return 0;
+#endif
+        }
+
+        void query_done(std::uint64_t t0, std::size_t queries, std::size_t bases) const {
+#ifdef FASTA_ENABLE_STATS
+            std::uint64_t ns = query_start() - t0;
+            counters.queries.fetch_add(queries, std::memory_order_relaxed);
+            counters.bases.fetch_add(bases, std::memory_order_relaxed);
+            counters.fetch_ns.fetch_add(ns, std::memory_order_relaxed);
+            if (latency_hook) latency_hook(ns, bases);
+#else
+            (void)t0;
+            (void)queries;
+            (void)bases;
+#endif
+        }
+
+        void index_done(std::uint64_t t0) const {
+#ifdef FASTA_ENABLE_STATS
+            counters.index_ns.fetch_add(query_start() - t0, std::memory_order_relaxed);
+#else
+            (void)t0;
+#endif
+        }
+
+        // counts bytes taken from the file, by a positioned read unless
+        // they were copied out of the mapping
+        void count_read(std::uint64_t bytes, bool seek = true) const {
+#ifdef FASTA_ENABLE_STATS
+            counters.bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+            if (seek) counters.reads.fetch_add(1, std::memory_order_relaxed);
+#else
+            (void)bytes;
+            (void)seek;
+#endif
+        }
+
+        fasta_detail::ThreadPool* async_pool() const {
+            std::lock_guard<std::mutex> lock(async_mutex);
+            if (!pool) pool.reset(new fasta_detail::ThreadPool(std::max(4u, std::thread::hardware_concurrency())));
+            return pool.get();
+        }
+
+#ifdef FASTA_HAVE_IO_URING
+        // the io_uring reader, or null if the kernel won't set one up
+        fasta_detail::UringReader* async_ring() const {
+            std::lock_guard<std::mutex> lock(async_mutex);
+            if (!ring_tried) {
+                ring_tried = true;
+                ring.reset(new fasta_detail::UringReader);
+                if (!ring->start()) ring.reset();
+            }
+            return ring.get();
+        }
+#endif
+
+        // builds the index from scratch, on threads threads where possible
+        void rebuild_index(unsigned threads) {
+            std::lock_guard<std::mutex> lock(index_mutex);
+            std::uint64_t t0 = query_start();
+            if (threads != 1 && compress == Compression::None) {
+                if (mode == Backend::Mmap) {
+                    clear_index();
+                    set_index(FASTAIndexBuilder::index(map_data, map_size, threads));
+                    index_done(t0);
+                    return;
+                }
+                const char* data;
+                std::size_t size;
+                if (map_path(file, data, size)) {
+                    clear_index();
+                    try {
+                        set_index(FASTAIndexBuilder::index(data, size, threads));
+                    } catch (...) {
+                        unmap_path(data, size);
+                        throw;
+                    }
+                    unmap_path(data, size);
+                    index_done(t0);
+                    return;
+                }
+            }
+            scan_index();
+        }
+
+        // builds the index if there is none yet
+        void ensure_index() const {
+            if (has_index()) return;
+            std::lock_guard<std::mutex> lock(index_mutex);
+            if (!has_index()) scan_index();
+        }
+
+        // lays out a FASTASequences block at image and copies every record in
+        void fill_image(char* image, bool caps, unsigned threads) const {
+            FASTASequences::write_image(image, index_entries);
+            if (compress == Compression::Gzip) {
+                FASTAReader reader(file);
+                FASTARecord rec;
+                for (std::size_t i = 0; i < index_entries.size(); i++) {
+                    if (!reader.next(rec) || rec.sequence.size() != index_entries[i].length) {
+                        throw std::runtime_error("Index doesn't match file: " + file);
+                    }
+                    fasta_strip_copy(FASTASequences::bases(image, i), rec.sequence.data(), rec.sequence.size(), caps);
+                }
+                FASTASequences::finish_image(image);
+                return;
+            }
+
+            const char* data = mode == Backend::Mmap ? map_data : nullptr;
+            std::size_t size = map_size;
+            bool mapped = !data && compress == Compression::None && map_path(file, data, size);
+            try {
+                fasta_detail::parallel_for(threads, index_entries.size(), [&](std::size_t i) {
+                    const FASTAIndexEntry& rec = index_entries[i];
+                    if (rec.length == 0) return;
+                    if (!data) {
+                        copy_bases(rec, 0, rec.length, FASTASequences::bases(image, i), caps);
+                        return;
+                    }
+                    std::uint64_t len = rec.byte_offset(rec.length - 1) - rec.offset + 1;
+                    if (rec.offset + len > size) {
+                        throw std::runtime_error("End coordinate out of bounds");
+                    }
+                    std::size_t col = 0;
+                    char* out = FASTASequences::bases(image, i);
+                    strip_lines(rec, data + rec.offset, len, col, out, caps);
+                });
+            } catch (...) {
+                if (mapped) unmap_path(data, size);
+                throw;
+            }
+            if (mapped) unmap_path(data, size);
+            FASTASequences::finish_image(image);
+        }
+
+        // builds the index from the file. index_mutex must be held.
+        void scan_index() const {
+            std::uint64_t t0 = query_start();
+            clear_index();
+            if (shared) {
+                set_index(shared_index());
+                index_done(t0);
+                return;
+            }
+            FASTAIndexBuilder builder;
+            if (mode == Backend::Mmap) {
+                builder.feed(map_data, map_size);
+            } else if (compress != Compression::None && !source) {
+                std::unique_ptr<std::istream> in = fasta_detail::open_input(file);
+                std::vector<char> buf(FASTA_BLOCK_SIZE);
+                while (*in) {
+                    in->read(buf.data(), buf.size());
+                    builder.feed(buf.data(), in->gcount());
+                }
+                if (in->bad()) throw std::runtime_error("Error reading file: " + file);
+            } else {
+                std::vector<char> buf(FASTA_BLOCK_SIZE);
+                std::uint64_t offset = 0;
+                std::size_t n;
+                while ((n = read_at(offset, buf.data(), buf.size())) > 0) {
+                    builder.feed(buf.data(), n);
+                    offset += n;
+                }
+            }
+            set_index(builder.finish());
+            index_done(t0);
+        }
+
+        // tells the OS that len bytes at offset will be read soon, or that
+        // the range will be read in order if sequential is set. only a hint,
+        // so failures are ignored; compressed files get none.
+        void advise(std::uint64_t offset, std::uint64_t len, bool sequential) const {
+#ifdef FASTA_HAVE_POSIX
+            if (compress != Compression::None || len == 0) return;
+            if (mode == Backend::Mmap) {
+                if (offset >= map_size) return;
+                len = std::min<std::uint64_t>(len, map_size - offset);
+                std::uintptr_t page = sysconf(_SC_PAGESIZE);
+                std::uintptr_t at = reinterpret_cast<std::uintptr_t>(map_data + offset);
+                std::uintptr_t start = at & ~(page - 1);
+                madvise(reinterpret_cast<void*>(start), at + len - start, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+            } else if (fd >= 0) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+                posix_fadvise(fd, offset, len, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_WILLNEED);
+#endif
+            }
+#else
+            (void)offset;
+            (void)len;
+            (void)sequential;
+#endif
+        }
+
+        // reads up to n bytes at offset without moving any shared file
+        // position. returns the number of bytes read, less than n at the end
+        // of the file. offsets in compressed files are uncompressed offsets.
+        std::size_t read_at(std::uint64_t offset, char* dst, std::size_t n) const {
+            if (compress == Compression::Gzip) {
+                throw std::runtime_error("Random access needs a BGZF-compressed file: " + file);
+            }
+#ifdef FASTA_USE_ZLIB
+            if (compress == Compression::Bgzf) return bgzf.read(offset, dst, n);
+#endif
+            return raw_read_at(offset, dst, n);
+        }
+
+        // the len bytes at offset: in the mapping, or read into buf
+        const char* raw_bytes(std::uint64_t offset, std::uint64_t len, std::vector<char>& buf) const {
+            if (mode == Backend::Mmap) {
+                if (offset + len > map_size) {
+                    throw std::runtime_error("End coordinate out of bounds");
+                }
+                count_read(len, false);
+                return map_data + offset;
+            }
+            buf.resize(len);
+            if (read_at(offset, buf.data(), len) != len) {
+                throw std::runtime_error("End coordinate out of bounds");
+            }
+            return buf.data();
+        }
+
+        // adds the counts of the n bases from the 0-based position pos of
+        // rec. line endings are never counted, so the bytes can be counted
+        // in pieces split anywhere.
+        void count_range(const FASTAIndexEntry& rec, std::size_t pos, std::size_t n, std::uint64_t* counts) const {
+            if (n == 0) return;
+            std::uint64_t first = rec.byte_offset(pos);
+            std::uint64_t len = rec.byte_offset(pos + n - 1) - first + 1;
+            if (mode == Backend::Mmap) {
+                std::vector<char> unused;
+                fasta_detail::count_bases(raw_bytes(first, len, unused), len, counts);
+                return;
+            }
+            char buf[1 << 16];
+            while (len > 0) {
+                std::size_t k = std::min<std::uint64_t>(len, sizeof(buf));
+                if (read_at(first, buf, k) != k) {
+                    throw std::runtime_error("End coordinate out of bounds");
+                }
+                fasta_detail::count_bases(buf, k, counts);
+                first += k;
+                len -= k;
+            }
+        }
+
+        // checks one record's lines against the file a large piece at a
+        // time, and classifies its bases. the line endings are counted as
+        // well as looked for at the end of each line, so a line ending
+        // out of place anywhere is caught.
+        void validate_record(FASTAIndexEntry& rec) const {
+            rec.alphabet = FASTAAlphabet::Unchecked;
+            rec.soft_masked = false;
+            rec.crlf = false;
+            if (rec.length == 0) {
+                rec.alphabet = FASTAAlphabet::DNA;
+                return;
+            }
+            std::size_t bases = rec.line_bases;
+            std::size_t width = rec.line_width;
+            std::size_t ending = width - bases;
+            std::size_t lines = (rec.length + bases - 1) / bases;
+            if (ending > 2 || (ending == 0 && lines > 1)) bad_layout(rec, rec.offset);
+
+            std::uint8_t mask = 0;
+            std::vector<char> buf;
+            std::size_t per_piece = std::max<std::size_t>(1, FASTA_BLOCK_SIZE / width);
+            for (std::size_t line = 0; line < lines; line += per_piece) {
+                std::size_t m = std::min(per_piece, lines - line);
+                bool last = line + m == lines;
+                std::size_t ends = m - last; // line endings within this piece
+                std::uint64_t first = rec.byte_offset(line * bases);
+                std::uint64_t len = rec.byte_offset(std::min(rec.length, (line + m) * bases) - 1) - first + 1;
+                if (!last) len += ending;
+                const char* bytes = raw_bytes(first, len, buf);
+
+                fasta_detail::ByteClasses classes;
+                fasta_detail::classify(bytes, len, classes);
+                if (classes.newlines != ends || classes.returns != (ending == 2 ? ends : 0)) {
+                    bad_layout(rec, first);
+                }
+                for (std::size_t j = 0; j < ends; j++) {
+                    const char* end = bytes + j * width + bases;
+                    if (end[ending - 1] != '\n' || (ending == 2 && end[0] != '\r')) {
+                        bad_layout(rec, first + j * width + bases);
+                    }
+                }
+                mask |= classes.mask;
+            }
+            if (!shared) check_record_end(rec);
+            rec.alphabet = fasta_detail::alphabet_of(mask);
+            rec.soft_masked = mask & fasta_detail::CLASS_LOWER;
+            rec.crlf = ending == 2;
+        }
+
+        // checks that the last base of rec is followed by nothing but line
+        // endings up to the next header or the end of the file
+        void check_record_end(const FASTAIndexEntry& rec) const {
+            std::uint64_t at = rec.byte_offset(rec.length - 1) + 1;
+            char tail[64];
+            std::size_t n;
+            if (mode == Backend::Mmap) {
+                n = at < map_size ? std::min<std::uint64_t>(sizeof(tail), map_size - at) : 0;
+                if (n) std::memcpy(tail, map_data + at, n);
+            } else {
+                n = read_at(at, tail, sizeof(tail));
+            }
+            std::size_t i = 0;
+            while (i < n && (tail[i] == '\n' || tail[i] == '\r')) i++;
+            if (i < n && (i == 0 || tail[i] != '>')) bad_layout(rec, at + i);
+        }
+
+        [[noreturn]] void bad_layout(const FASTAIndexEntry& rec, std::uint64_t byte) const {
+            throw std::runtime_error("Record " + rec.name + " doesn't match the index at byte "
+                + std::to_string(byte) + " of " + file);
+        }
+
+        static Composition make_composition(const std::uint64_t* counts, std::size_t length) {
+            Composition c;
+            c.a = counts[fasta_detail::COUNT_A];
+            c.c = counts[fasta_detail::COUNT_C];
+            c.g = counts[fasta_detail::COUNT_G];
+            c.t = counts[fasta_detail::COUNT_T];
+            c.n = counts[fasta_detail::COUNT_N];
+            c.lower = counts[fasta_detail::COUNT_LOWER];
+            c.length = length;
+            c.other = length - c.a - c.c - c.g - c.t - c.n;
+            return c;
+        }
+
+        // reads the file's own bytes, as read_at does for uncompressed files
+        std::size_t raw_read_at(std::uint64_t offset, char* dst, std::size_t n) const {
+            if (source) {
+                std::size_t done = source->read_at(offset, dst, n);
+                count_read(done);
+                return done;
+            }
+#ifdef FASTA_HAVE_POSIX
+            std::size_t done = 0;
+            while (done < n) {
+                ssize_t k = ::pread(fd, dst + done, n - done, offset + done);
+                if (k < 0 && errno == EINTR) continue;
+                if (k < 0) throw std::runtime_error("Error reading file: " + file + "!");
+                if (k == 0) break;
+                done += k;
+            }
+            count_read(done);
+            return done;
+#else
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            infile.clear();
+            infile.seekg(offset);
+            infile.read(dst, n);
+            std::size_t done = infile.gcount();
+            infile.clear();
+            count_read(done);
+            return done;
+#endif
+        }
+
+        // the index of a shared store: each record is one line of bases
+        // with no line ending, so the usual offset arithmetic applies
+        std::vector<FASTAIndexEntry> shared_index() const {
+            FASTASequences image;
+            image.base = map_data;
+            std::vector<FASTAIndexEntry> entries(image.size());
+            for (std::size_t i = 0; i < entries.size(); i++) {
+                const FASTASequences::Entry& e = image.entries()[i];
+                entries[i].name = std::string(image.name(i));
+                entries[i].length = e.length;
+                entries[i].offset = e.seq_off;
+                entries[i].line_bases = entries[i].line_width = std::max<std::uint64_t>(e.length, 1);
+            }
+            return entries;
+        }
+
+        void set_index(std::vector<FASTAIndexEntry> entries) const {
+            index_entries = std::move(entries);
+            record_starts.clear();
+            record_lookup.clear();
+            record_lookup.reserve(index_entries.size());
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < index_entries.size(); i++) {
+                record_starts.push_back(total);
+                total += index_entries[i].length;
+                // like samtools, the first of several records with one name wins
+                record_lookup.emplace(index_entries[i].name, i);
             }
+            indexed.store(true, std::memory_order_release);
         }
 
-        ~FASTAFile() { infile.close(); }
+        const FASTAIndexEntry& lookup(const std::string& name) const {
+            const FASTAIndexEntry* rec = find_record(name);
+            if (!rec) throw std::runtime_error("No such record: " + name);
+            return *rec;
+        }
 
-        // returns false if opening the file failed
-        // use this only if you used the default constructor.
-        bool open(const std::string& filename) {
-            file = filename;
-            infile = std::ifstream(file);
-            if (!infile) return false;
+        // looks up a record, building the index if needed, and checks that
+        // start and end lie within it
+        const FASTAIndexEntry& checked_record(const std::string& name, std::size_t start, std::size_t end) const {
+            ensure_index();
+            const FASTAIndexEntry& rec = lookup(name);
+            range_length(start, end);
+            if (end > rec.length) {
+                throw std::runtime_error("End coordinate out of bounds");
+            }
+            return rec;
+        }
+
+        bool map_file() {
+            return map_path(file, map_data, map_size);
+        }
+
+#ifdef FASTA_HAVE_POSIX
+        // a source for url, or null if the server says it hasn't got it.
+        // any other failure is thrown, rather than taken for a missing file.
+        static std::shared_ptr<FASTAByteSource> optional_url(const std::string& url,
+                const std::vector<std::string>& headers) {
+            try {
+                return std::make_shared<FASTAHttpSource>(url, headers);
+            } catch (const FASTAHttpError& e) {
+                if (e.status() == 404 || e.status() == 410) return nullptr;
+                throw;
+            }
+        }
+#endif
+
+        void unmap_file() {
+            unmap_path(map_data, map_size);
+        }
+
+        // maps a whole file read-only. data is null for an empty file.
+        static bool map_path(const std::string& path, const char*& data, std::size_t& size) {
+            data = nullptr;
+            size = 0;
+#ifdef FASTA_HAVE_POSIX
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            if (st.st_size > 0) {
+                void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    return false;
+                }
+                data = static_cast<const char*>(p);
+                size = st.st_size;
+            }
+            ::close(fd);
             return true;
+#else
+            (void)path;
+            return false;
+#endif
         }
 
-        // closes the file
-        void close() {
-            infile.close();
+        static void unmap_path(const char*& data, std::size_t& size) {
+#ifdef FASTA_HAVE_POSIX
+            if (data) munmap(const_cast<char*>(data), size);
+#endif
+            data = nullptr;
+            size = 0;
         }
 
-        // gets a string of nucleotides from start to end, inclusive;
-        // so specifying 1, 2 would get 2nt
-        // 'caps' defaults to false. If specified, this uppercases all nucleotides
-        std::string get_sequence(std::size_t start, std::size_t end, bool caps = false) {
-            std::string ret;
-            std::string tmpline;
-            char tmp;
-            infile.seekg(0);
-            std::size_t count = 0;
-            std::size_t curpos = 0;
-            infile.seekg(start);
-            while (curpos+1 != start && std::getline(infile, tmpline)) {
-                if ('>' != tmpline[0]) {
-                    char c;
-                    for (std::size_t i = 0; i < tmpline.size(); i++) {
-                        c = tmpline[i];
-                        if (curpos + 1 == start) {
-                            infile.seekg((std::size_t)infile.tellg() - (tmpline.size() - i));
-                            break;
-                        }
-                        if (std::isprint(c)) {
-                            curpos++;
-                        }
+        // checks 1-based inclusive coordinates and returns their length
+        static std::size_t range_length(std::size_t start, std::size_t end) {
+            if (start == 0 || end < start) {
+                throw std::runtime_error("Invalid coordinates");
+            }
+            return end - start + 1;
+        }
+
+        static void check_capacity(std::size_t n, std::size_t cap) {
+            if (cap < n) {
+                throw std::runtime_error("Buffer too small for the requested sequence");
+            }
+        }
+
+        void load_index(std::istream& in) {
+            clear_index();
+            std::vector<FASTAIndexEntry> entries;
+            std::string line;
+            std::size_t lineno = 0;
+            while (std::getline(in, line)) {
+                lineno++;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+
+                // NAME LENGTH OFFSET LINEBASES LINEWIDTH [QUALOFFSET]
+                std::size_t fields[4];
+                std::size_t tab = line.find('\t');
+                if (tab == std::string::npos) bad_index(lineno);
+                FASTAIndexEntry e;
+                e.name = line.substr(0, tab);
+                for (int i = 0; i < 4; i++) {
+                    std::size_t pos = tab + 1;
+                    tab = line.find('\t', pos);
+                    std::string field = line.substr(pos, tab == std::string::npos ? tab : tab - pos);
+                    if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos) {
+                        bad_index(lineno);
+                    }
+                    // a field of digits can still be too large
+                    unsigned long long v;
+                    try {
+                        v = std::stoull(field);
+                    } catch (const std::logic_error&) {
+                        bad_index(lineno);
                     }
+                    if (v > std::numeric_limits<std::size_t>::max()) bad_index(lineno);
+                    fields[i] = v;
+                    if (i < 3 && tab == std::string::npos) bad_index(lineno);
                 }
+                e.length = fields[0];
+                e.offset = fields[1];
+                e.line_bases = fields[2];
+                e.line_width = fields[3];
+                if (e.length > 0 && (e.line_bases == 0 || e.line_width < e.line_bases)) {
+                    bad_index(lineno);
+                }
+                entries.push_back(std::move(e));
+            }
+            set_index(std::move(entries));
+        }
+
+        [[noreturn]] void bad_index(std::size_t lineno) {
+            clear_index();
+            throw std::runtime_error("Malformed index for " + file + " at line " + std::to_string(lineno));
+        }
+
+        std::size_t total_length() const {
+            return index_entries.empty() ? 0 : record_starts.back() + index_entries.back().length;
+        }
+
+        // writes n bases starting at the 1-based position start, over the
+        // concatenated records. the index is built first if none is loaded,
+        // so every backend counts the same bases.
+        void global_bases(char* dst, std::size_t start, std::size_t n, bool caps) const {
+            ensure_index();
+            if (start - 1 + n > total_length()) {
+                throw std::runtime_error("End coordinate out of bounds");
+            }
+
+            // find the record holding the first base, then walk forward
+            std::size_t pos = start - 1;
+            std::size_t end = pos + n;
+            std::size_t r = std::upper_bound(record_starts.begin(), record_starts.end(), pos)
+                - record_starts.begin() - 1;
+            while (pos < end) {
+                const FASTAIndexEntry& rec = index_entries[r];
+                std::size_t local = pos - record_starts[r];
+                std::size_t k = std::min(rec.length - local, end - pos);
+                copy_bases(rec, local, k, dst, caps);
+                dst += k;
+                pos += k;
+                r++;
             }
+        }
+
+        // writes n bases starting at the 0-based position pos of rec to out,
+        // or their reverse complement if reverse is set. rec must be one of
+        // index_entries.
+        void copy_bases(const FASTAIndexEntry& rec, std::size_t pos, std::size_t n, char* out, bool caps,
+                bool reverse = false) const {
+            if (n == 0) return;
+            if (cache_block == 0) {
+                read_bases(rec, pos, n, out, caps, reverse);
+                return;
+            }
+
+            // the reverse strand is written from the end of out backwards
+            const char* table = reverse ? fasta_detail::complement_table(caps) : nullptr;
+            if (reverse) out += n;
 
-            while (count < (end - start) + 1) {
-                tmp = infile.get();
+            std::size_t r = &rec - index_entries.data();
+            for (std::size_t b = pos / cache_block; n > 0; b++) {
+                fasta_detail::BlockCache<BlockKey, BlockKeyHash>::Data data = cache.find(BlockKey{r, b});
+                if (!data) {
+                    std::size_t start = b * cache_block;
+                    auto block = std::make_shared<std::vector<char>>(std::min(cache_block, rec.length - start));
+                    read_bases(rec, start, block->size(), block->data(), false);
+                    cache.insert(BlockKey{r, b}, block);
+                    data = block;
+                }
+                std::size_t at = pos - b * cache_block;
+                std::size_t k = std::min(data->size() - at, n);
+                if (reverse) {
+                    fasta_detail::reverse_complement_copy(out, data->data() + at, k, table);
+                    out -= k;
+                } else {
+                    out += fasta_strip_copy(out, data->data() + at, k, caps);
+                }
+                pos += k;
+                n -= k;
+            }
+        }
 
-                if (IS_EOF(tmp)) {
+        // writes n bases starting at the 0-based position pos of rec to out,
+        // reading only the bytes that cover them
+        void read_bases(const FASTAIndexEntry& rec, std::size_t pos, std::size_t n, char* out, bool caps,
+                bool reverse = false) const {
+            std::uint64_t first = rec.byte_offset(pos);
+            std::uint64_t len = rec.byte_offset(pos + n - 1) - first + 1;
+            std::size_t col = pos % rec.line_bases;
+            if (reverse) out += n;
+            if (mode == Backend::Mmap) {
+                if (first + len > map_size) {
                     throw std::runtime_error("End coordinate out of bounds");
                 }
+                strip_lines(rec, map_data + first, len, col, out, caps, reverse);
+                count_read(len, false);
+            } else {
+                char buf[1 << 16];
+                while (len > 0) {
+                    std::size_t k = std::min<std::uint64_t>(len, sizeof(buf));
+                    if (read_at(first, buf, k) != k) {
+                        throw std::runtime_error("End coordinate out of bounds");
+                    }
+                    strip_lines(rec, buf, k, col, out, caps, reverse);
+                    first += k;
+                    len -= k;
+                }
+            }
+        }
 
-                if (std::isprint(tmp)) {
-                    if (caps) {
-                        ret += std::toupper(tmp);
+        // copies the bases in src to out, skipping line endings. col is the
+        // byte position within the current line and carries across calls.
+        // with reverse set, out is the end of the space left and the
+        // complemented bases are written backwards from it. throws if a
+        // line ending turns up where the index says there are bases.
+        static void strip_lines(const FASTAIndexEntry& rec, const char* src, std::size_t len,
+                std::size_t& col, char*& out, bool caps, bool reverse = false) {
+            const char* table = reverse ? fasta_detail::complement_table(caps) : nullptr;
+            // a validated record's lines hold only bases, so without case
+            // to change they are copied as they are
+            bool plain = rec.alphabet != FASTAAlphabet::Unchecked && (!caps || !rec.soft_masked);
+            while (len > 0) {
+                std::size_t k;
+                if (col < rec.line_bases) {
+                    k = std::min(rec.line_bases - col, len);
+                    if (reverse) {
+                        if (!plain && (std::memchr(src, '\n', k) || std::memchr(src, '\r', k))) {
+                            line_ending_in_bases(rec);
+                        }
+                        fasta_detail::reverse_complement_copy(out, src, k, table);
+                        out -= k;
+                    } else if (plain) {
+                        std::memcpy(out, src, k);
+                        out += k;
                     } else {
-                        ret += tmp;
+                        if (fasta_strip_copy(out, src, k, caps) != k) line_ending_in_bases(rec);
+                        out += k;
+                    }
+                } else {
+                    k = std::min(rec.line_width - col, len);
+                }
+                src += k;
+                len -= k;
+                col += k;
+                if (col == rec.line_width) col = 0;
+            }
+        }
+
+        [[noreturn]] static void line_ending_in_bases(const FASTAIndexEntry& rec) {
+            throw std::runtime_error("Record " + rec.name + " has a line ending where the index has bases");
+        }
+};
+
+// writes FASTA records with a fixed number of bases per line, building the
+// .fai index as it goes, so the file can be queried as soon as it is
+// closed. records can come from several threads: each is formatted on the
+// thread that writes it and goes out in the order of its slot.
+class FASTAWriter {
+    public:
+        using Compression = fasta_detail::Compression;
+
+        FASTAWriter() {}
+        FASTAWriter(const std::string& filename, std::size_t line_width = 60,
+                Compression compression = Compression::None, unsigned threads = 1) {
+            if (!open(filename, line_width, compression, threads)) {
+                throw std::runtime_error("Error opening file: " + filename + "!");
+            }
+        }
+        FASTAWriter(const FASTAWriter&) = delete;
+        FASTAWriter& operator=(const FASTAWriter&) = delete;
+
+        ~FASTAWriter() { close(); }
+
+        // returns false if the file could not be created. line_width 0 puts
+        // each record on one line. Bgzf (or Gzip, which is written as BGZF)
+        // compresses on threads threads (0 for one per core) when built with
+        // FASTA_USE_ZLIB, and also writes a .gzi at close().
+        bool open(const std::string& filename, std::size_t line_width = 60,
+                Compression compression = Compression::None, unsigned threads = 1) {
+            close();
+#ifndef FASTA_USE_ZLIB
+            if (compression != Compression::None) return false;
+            (void)threads;
+#endif
+            // the stream's own buffer would only copy the large writes again
+            out.rdbuf()->pubsetbuf(nullptr, 0);
+            out.open(filename, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            file = filename;
+            width = line_width;
+            compress = compression != Compression::None;
+            failed = false;
+            next_slot = 0;
+            next_out = 0;
+            pending_bytes = 0;
+            offset = 0;
+            entries.clear();
+            if (!sink.data()) sink.reset(FASTA_WRITER_BUFFER_BYTES);
+#ifdef FASTA_USE_ZLIB
+            if (compress) buf.reserve(fasta_detail::BGZF_BLOCK_DATA);
+            coffset = 0;
+            block_start = 0;
+            if (compress && fasta_detail::thread_count(threads) > 1) {
+                pool.reset(new fasta_detail::ThreadPool(fasta_detail::thread_count(threads)));
+            }
+#endif
+            return true;
+        }
+
+        // the next slot number, counting from 0. write(name, ...) takes
+        // one itself; threads writing their own numbering (record i into
+        // slot i) shouldn't mix it with this.
+        std::size_t reserve() {
+            return next_slot.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // appends a record after every one written before it. the header is
+        // the name, then the description if there is one. throws a
+        // std::runtime_error if the file can't be written, or a
+        // std::invalid_argument if the header couldn't be read back: a name
+        // that is empty or starts with '>', or a line ending in either part.
+        void write(std::string_view name, std::string_view sequence, std::string_view description = {}) {
+            check_header(name, description);
+            write(reserve(), name, sequence, description);
+        }
+
+        void write(const FASTARecord& rec) {
+            write(rec.name, rec.sequence, rec.description);
+        }
+
+        // writes a record into a slot. it goes out once every lower slot has
+        // been written; meanwhile it is held in memory. while the records
+        // held reach FASTA_WRITER_QUEUE_BYTES, writers of later slots wait.
+        void write(std::size_t slot, std::string_view name, std::string_view sequence,
+                std::string_view description = {}) {
+            check_header(name, description);
+            Pending rec;
+            format(rec, name, sequence, description);
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!out.is_open()) throw std::runtime_error("No file open for writing");
+            space.wait(lock, [&] {
+                return failed || slot <= next_out || pending_bytes < FASTA_WRITER_QUEUE_BYTES;
+            });
+            if (failed) throw std::runtime_error("Error writing file: " + file + "!");
+            if (slot < next_out || held.count(slot)) {
+                throw std::runtime_error("Slot " + std::to_string(slot) + " was written twice");
+            }
+            pending_bytes += rec.text.size();
+            held.emplace(slot, std::move(rec));
+            try {
+                drain();
+            } catch (...) {
+                failed = true;
+                space.notify_all();
+                throw;
+            }
+            space.notify_all();
+        }
+
+        void write(std::size_t slot, const FASTARecord& rec) {
+            write(slot, rec.name, rec.sequence, rec.description);
+        }
+
+        // the index of the records written so far. read it once the writers
+        // have finished.
+        const std::vector<FASTAIndexEntry>& index() const { return entries; }
+
+        // writes out the buffers and the .fai (and .gzi) next to the file.
+        // returns false if anything failed, or if a slot below the last one
+        // written was never filled, in which case the records after the gap
+        // are lost. call it after every writer has finished.
+        bool close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!out.is_open()) return !failed;
+            bool ok = !failed && held.empty();
+            try {
+                if (!failed) {
+#ifdef FASTA_USE_ZLIB
+                    if (compress) {
+                        flush_buffer();
+                        finish_blocks(0);
+                        put(reinterpret_cast<const char*>(fasta_detail::BGZF_EOF), sizeof(fasta_detail::BGZF_EOF));
                     }
-                    count++;
+#endif
+                    write_sink();
+                }
+            } catch (...) {
+                ok = false;
+            }
+#ifdef FASTA_USE_ZLIB
+            pool.reset();
+            jobs.clear();
+#endif
+            out.close();
+            ok = ok && !out.fail();
+            if (ok) ok = fasta_detail::write_fai(file + ".fai", entries);
+#ifdef FASTA_USE_ZLIB
+            if (ok && compress) ok = write_gzi(file + ".gzi");
+            gzi.clear();
+#endif
+            held.clear();
+            buf.clear();
+            sink.clear();
+            failed = !ok;
+            return ok;
+        }
+
+    private:
+        // a formatted record waiting for its turn
+        struct Pending {
+            std::string text;
+            std::size_t header = 0; // bytes of the header line
+            FASTAIndexEntry entry;  // offset relative to the record's start
+        };
+
+        std::string file;
+        std::ofstream out;
+        std::size_t width = 60;
+        bool compress = false;
+        bool failed = false;
+
+        std::mutex mutex;
+        std::condition_variable space;
+        std::atomic<std::size_t> next_slot{0};
+        std::size_t next_out = 0; // the slot to write next
+        std::unordered_map<std::size_t, Pending> held;
+        std::size_t pending_bytes = 0;
+
+        fasta_detail::AlignedBuffer sink; // output not yet written
+        std::vector<char> buf;            // output not yet compressed
+        std::uint64_t offset = 0;         // uncompressed bytes written so far
+        std::vector<FASTAIndexEntry> entries;
+
+#ifdef FASTA_USE_ZLIB
+        // a block being compressed, and its uncompressed size
+        struct Job {
+            std::future<std::string> block;
+            std::size_t size;
+        };
+
+        std::unique_ptr<fasta_detail::ThreadPool> pool;
+        std::list<Job> jobs;                      // in file order
+        std::uint64_t coffset = 0;                // compressed bytes written so far
+        std::uint64_t block_start = 0;            // uncompressed offset of the next block
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> gzi;
+#endif
+
+        static void check_header(std::string_view name, std::string_view desc) {
+            auto breaks = [](std::string_view s) { return s.find_first_of("\r\n") != std::string_view::npos; };
+            if (name.empty() || name[0] == '>' || breaks(name) || breaks(desc)) {
+                throw std::invalid_argument("Invalid record header: >" + std::string(name)
+                    + (desc.empty() ? "" : " " + std::string(desc)));
+            }
+        }
+
+        // lays out a record's lines and its index entry
+        void format(Pending& rec, std::string_view name, std::string_view seq, std::string_view desc) const {
+            std::size_t w = width ? width : std::max<std::size_t>(seq.size(), 1);
+            std::size_t lines = (seq.size() + w - 1) / w;
+            rec.header = 1 + name.size() + (desc.empty() ? 0 : 1 + desc.size()) + 1;
+            rec.text.resize(rec.header + seq.size() + lines);
+            char* p = &rec.text[0];
+            *p++ = '>';
+            std::memcpy(p, name.data(), name.size());
+            p += name.size();
+            if (!desc.empty()) {
+                *p++ = ' ';
+                std::memcpy(p, desc.data(), desc.size());
+                p += desc.size();
+            }
+            *p++ = '\n';
+            for (std::size_t i = 0; i < seq.size(); i += w) {
+                std::size_t k = std::min(w, seq.size() - i);
+                std::memcpy(p, seq.data() + i, k);
+                p += k;
+                *p++ = '\n';
+            }
+
+            // the name as FASTAIndexBuilder reads it back
+            std::size_t end = 0;
+            while (end < name.size() && !std::isspace(static_cast<unsigned char>(name[end]))) end++;
+            rec.entry.name = std::string(name.substr(0, end));
+            rec.entry.length = seq.size();
+            if (!seq.empty()) {
+                // a record on one line is as wide as that line
+                rec.entry.line_bases = std::min(w, seq.size());
+                rec.entry.line_width = rec.entry.line_bases + 1;
+            }
+        }
+
+        // writes out the held records that are next in line. mutex must be
+        // held.
+        void drain() {
+            if (failed) throw std::runtime_error("Error writing file: " + file + "!");
+            for (auto it = held.find(next_out); it != held.end(); it = held.find(next_out)) {
+                Pending& rec = it->second;
+                rec.entry.offset = offset + rec.header;
+                emit(rec.text.data(), rec.text.size());
+                entries.push_back(std::move(rec.entry));
+                pending_bytes -= rec.text.size();
+                held.erase(it);
+                next_out++;
+            }
+        }
+
+        void emit(const char* p, std::size_t n) {
+            offset += n;
+            if (!compress) {
+                put(p, n);
+                return;
+            }
+#ifdef FASTA_USE_ZLIB
+            while (n > 0) {
+                std::size_t k = std::min(fasta_detail::BGZF_BLOCK_DATA - buf.size(), n);
+                buf.insert(buf.end(), p, p + k);
+                p += k;
+                n -= k;
+                if (buf.size() == fasta_detail::BGZF_BLOCK_DATA) flush_buffer();
+            }
+#endif
+        }
+
+        // copies bytes bound for the file into the sink, writing it out
+        // each time it fills
+        void put(const char* p, std::size_t n) {
+            while (n > 0) {
+                std::size_t k = sink.append(p, n);
+                p += k;
+                n -= k;
+                if (sink.full()) write_sink();
+            }
+        }
+
+        void write_sink() {
+            if (sink.empty()) return;
+            if (!out.write(sink.data(), sink.size())) {
+                throw std::runtime_error("Error writing file: " + file + "!");
+            }
+            sink.clear();
+        }
+
+#ifdef FASTA_USE_ZLIB
+        // hands the buffer off to be compressed as one block
+        void flush_buffer() {
+            if (buf.empty()) return;
+            std::size_t n = buf.size();
+            if (pool) {
+                // the block keeps the buffer, and a new one is started
+                auto task = std::make_shared<std::packaged_task<std::string()>>(
+                    [data = std::move(buf)] { return fasta_detail::bgzf_block(data.data(), data.size()); });
+                jobs.push_back(Job{task->get_future(), n});
+                pool->submit([task] { (*task)(); });
+                buf = std::vector<char>();
+                buf.reserve(fasta_detail::BGZF_BLOCK_DATA);
+                finish_blocks(2 * pool->size());
+            } else {
+                put_block(fasta_detail::bgzf_block(buf.data(), n), n);
+                buf.clear();
+            }
+        }
+
+        // writes finished blocks in order until at most keep are in flight
+        void finish_blocks(std::size_t keep) {
+            while (jobs.size() > keep) {
+                Job job = std::move(jobs.front());
+                jobs.pop_front();
+                put_block(job.block.get(), job.size);
+            }
+        }
+
+        void put_block(const std::string& block, std::size_t size) {
+            if (coffset > 0) gzi.emplace_back(coffset, block_start);
+            put(block.data(), block.size());
+            coffset += block.size();
+            block_start += size;
+        }
+
+        bool write_gzi(const std::string& filename) const {
+            std::ofstream gz(filename, std::ios::binary);
+            if (!gz) return false;
+            fasta_detail::write_le(gz, gzi.size(), 8);
+            for (const auto& b : gzi) {
+                fasta_detail::write_le(gz, b.first, 8);
+                fasta_detail::write_le(gz, b.second, 8);
+            }
+            return static_cast<bool>(gz.flush());
+        }
+#endif
+};
+
+// a record stored with 2 bits per base, in the same layout as UCSC .2bit:
+// T=0, C=1, A=2, G=3, four bases to a byte with the first in the high bits.
+// runs of N, runs of other IUPAC codes and lowercase (soft-masked) runs are
+// kept in side lists, so the original text can be rebuilt exactly.
+class PackedSequence {
+    public:
+        // a run of identical bases, or of lowercase bases for mask_blocks().
+        // start is 0-based.
+        struct Block {
+            std::size_t start = 0;
+            std::size_t length = 0;
+            char base = 'N';
+        };
+
+        PackedSequence() = default;
+
+        // packs the bases in seq
+        explicit PackedSequence(std::string_view seq) { append(seq.data(), seq.size()); }
+
+        // packs the named record of a FASTA file, reading it in blocks
+        PackedSequence(const FASTAFile& fa, const std::string& name) {
+            const FASTAIndexEntry* rec = fa.find_record(name);
+            if (!rec) throw std::runtime_error("No such record: " + name);
+            bits.reserve((rec->length + 3) / 4);
+            std::vector<char> buf(FASTA_BLOCK_SIZE);
+            for (std::size_t start = 1; start <= rec->length; start += buf.size()) {
+                std::size_t end = std::min(rec->length, start + buf.size() - 1);
+                append(buf.data(), fa.get_sequence_into(buf.data(), buf.size(), name, start, end));
+            }
+        }
+
+        // packs n more bases onto the end
+        void append(const char* s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++, len++) {
+                char c = s[i];
+                int code = fasta_detail::base_code(c);
+                if (code < 0) {
+                    code = 0;
+                    char upper = fasta_detail::to_upper(c);
+                    add_run(upper == 'N' ? n_runs : other_runs, len, upper);
+                }
+                if (fasta_detail::is_lower(c)) add_run(mask_runs, len, 0);
+                if (len % 4 == 0) bits.push_back(0);
+                bits.back() |= code << (6 - 2 * (len % 4));
+            }
+        }
+
+        // the number of bases
+        std::size_t size() const { return len; }
+
+        // the 2-bit code of the base at the 0-based position pos. N and other
+        // IUPAC codes read as T (0).
+        int code(std::size_t pos) const {
+            return (bits[pos / 4] >> (6 - 2 * (pos % 4))) & 3;
+        }
+
+        // the base at the 0-based position pos, as it was in the original text
+        char base(std::size_t pos) const {
+            char c;
+            get_sequence_into(&c, 1, pos + 1, pos + 1);
+            return c;
+        }
+
+        // gets the bases from start to end, inclusive, like FASTAFile does.
+        // 'caps' drops the soft-masking.
+        std::string get_sequence(std::size_t start, std::size_t end, bool caps = false) const {
+            std::string ret(range(start, end), '\0');
+            get_sequence_into(&ret[0], ret.size(), start, end, caps);
+            return ret;
+        }
+
+        // like get_sequence(start, end, caps), but writes the bases to dst,
+        // which must hold at least cap bytes. returns the number of bases.
+        std::size_t get_sequence_into(char* dst, std::size_t cap, std::size_t start, std::size_t end,
+                bool caps = false) const {
+            std::size_t n = range(start, end);
+            if (cap < n) throw std::runtime_error("Buffer too small for the requested sequence");
+
+            std::size_t stop = start - 1 + n;
+            fasta_detail::unpack_bases(bits.data(), start - 1, n, dst);
+            overlay(n_runs, dst, start - 1, stop, false);
+            overlay(other_runs, dst, start - 1, stop, false);
+            if (!caps) overlay(mask_runs, dst, start - 1, stop, true);
+            return n;
+        }
+
+        // the packed bases, four to a byte
+        const std::vector<std::uint8_t>& packed() const { return bits; }
+
+        // runs of N, runs of other non-ACGT codes, and lowercase runs
+        const std::vector<Block>& n_blocks() const { return n_runs; }
+        const std::vector<Block>& other_blocks() const { return other_runs; }
+        const std::vector<Block>& mask_blocks() const { return mask_runs; }
+
+    private:
+        std::vector<std::uint8_t> bits;
+        std::size_t len = 0;
+        std::vector<Block> n_runs;
+        std::vector<Block> other_runs;
+        std::vector<Block> mask_runs;
+
+        std::size_t range(std::size_t start, std::size_t end) const {
+            if (start == 0 || end < start) {
+                throw std::runtime_error("Invalid coordinates");
+            }
+            if (end > len) {
+                throw std::runtime_error("End coordinate out of bounds");
+            }
+            return end - start + 1;
+        }
+
+        static void add_run(std::vector<Block>& runs, std::size_t pos, char base) {
+            if (!runs.empty() && runs.back().start + runs.back().length == pos && runs.back().base == base) {
+                runs.back().length++;
+            } else {
+                runs.push_back(Block{pos, 1, base});
+            }
+        }
+
+        // applies the runs overlapping [from, to) to dst, which holds the
+        // bases from 'from' on. lower lowercases instead of filling in bases.
+        static void overlay(const std::vector<Block>& runs, char* dst, std::size_t from, std::size_t to, bool lower) {
+            auto it = std::partition_point(runs.begin(), runs.end(), [from](const Block& b) {
+                return b.start + b.length <= from;
+            });
+            for (; it != runs.end() && it->start < to; ++it) {
+                std::size_t a = std::max(it->start, from);
+                std::size_t b = std::min(it->start + it->length, to);
+                for (std::size_t i = a; i < b; i++) {
+                    dst[i - from] = lower ? fasta_detail::to_lower(dst[i - from]) : it->base;
+                }
+            }
+        }
+};
+
+// reads UCSC .2bit files. the file is mapped into memory and only its record
+// table is parsed when opening; the packed bases, N blocks and mask blocks
+// are read in place. lookups are const and thread-safe.
+class TwoBitFile {
+    public:
+        TwoBitFile() = default;
+        explicit TwoBitFile(const std::string& filename) {
+            if (!open(filename)) {
+                throw std::runtime_error("Error opening file: " + filename + "!");
+            }
+        }
+        TwoBitFile(const TwoBitFile&) = delete;
+        TwoBitFile& operator=(const TwoBitFile&) = delete;
+
+        ~TwoBitFile() { close(); }
+
+        // returns false if opening the file failed, and throws a
+        // std::runtime_error if it is not a valid .2bit file
+        bool open(const std::string& filename) {
+            close();
+            file = filename;
+            if (!load()) return false;
+            try {
+                parse();
+            } catch (...) {
+                close();
+                throw;
+            }
+            return true;
+        }
+
+        void close() {
+#ifdef FASTA_HAVE_POSIX
+            if (data && size > 0) munmap(const_cast<unsigned char*>(data), size);
+#endif
+            data = nullptr;
+            size = 0;
+            copy.clear();
+            seqs.clear();
+            seq_names.clear();
+            lookup.clear();
+        }
+
+        // writes every record of fa to a .2bit file. IUPAC codes other than
+        // ACGT are stored as N, which is all the format allows. returns false
+        // if the file could not be written, and throws a std::runtime_error
+        // if a record can't be stored or two records share a name.
+        static bool write(const FASTAFile& fa, const std::string& filename) {
+            const std::vector<FASTAIndexEntry>& recs = fa.index();
+            if (recs.size() > 0xffffffffu) throw std::runtime_error("Too many records for .2bit: " + filename);
+            std::unordered_set<std::string> seen;
+            std::uint64_t estimate = 16;
+            for (const auto& r : recs) {
+                if (r.name.size() > 255) throw std::runtime_error("Record name too long for .2bit: " + r.name);
+                if (r.length > 0xffffffffu) throw std::runtime_error("Record too long for .2bit: " + r.name);
+                if (!seen.insert(r.name).second) {
+                    throw std::runtime_error("Duplicate record name for .2bit: " + r.name);
                 }
+                estimate += 1 + r.name.size() + 8 + 16 + (r.length + 3) / 4;
+            }
+            // version 1 has 64-bit record offsets. the estimate leaves out
+            // the N and mask blocks, so a version 0 file whose offsets turn
+            // out not to fit in 32 bits is written again as version 1.
+            bool fits = true;
+            if (estimate <= 0x7fffffffu) {
+                if (!write_records(fa, filename, 0, fits)) return false;
+                if (fits) return true;
             }
+            return write_records(fa, filename, 1, fits);
+        }
+
+        // the record names, in file order
+        const std::vector<std::string>& names() const { return seq_names; }
+
+        // the number of bases in the named record
+        std::size_t length(const std::string& name) const { return record(name).dna_size; }
+
+        // gets the bases from start to end, inclusive, of the named record,
+        // like FASTAFile::get_sequence(). 'caps' drops the soft-masking.
+        std::string get_sequence(const std::string& name, std::size_t start, std::size_t end, bool caps = false) const {
+            const Record& rec = checked(name, start, end);
+            std::string ret(end - start + 1, '\0');
+            unpack(rec, start - 1, ret.size(), &ret[0], caps);
             return ret;
         }
 
+        // like get_sequence(name, start, end, caps), but writes the bases to
+        // dst, which must hold at least cap bytes. returns the number of bases.
+        std::size_t get_sequence_into(char* dst, std::size_t cap, const std::string& name, std::size_t start,
+                std::size_t end, bool caps = false) const {
+            const Record& rec = checked(name, start, end);
+            std::size_t n = end - start + 1;
+            if (cap < n) throw std::runtime_error("Buffer too small for the requested sequence");
+            unpack(rec, start - 1, n, dst, caps);
+            return n;
+        }
+
     private:
+        static constexpr std::uint32_t TWOBIT_SIGNATURE = 0x1A412743;
+
+        struct Record {
+            std::size_t dna_size = 0;
+            std::uint32_t n_count = 0;
+            const unsigned char* n_blocks = nullptr;    // starts, then sizes
+            std::uint32_t mask_count = 0;
+            const unsigned char* mask_blocks = nullptr; // starts, then sizes
+            const std::uint8_t* dna = nullptr;
+        };
+
         std::string file;
-        std::ifstream infile;
+        const unsigned char* data = nullptr;
+        std::size_t size = 0;
+        std::vector<unsigned char> copy; // the file, where it can't be mapped
+        bool swapped = false;            // written on a machine of the other byte order
+        std::vector<Record> seqs;
+        std::vector<std::string> seq_names;
+        std::unordered_map<std::string, std::size_t> lookup;
+
+        bool load() {
+#ifdef FASTA_HAVE_POSIX
+            int fd = ::open(file.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            bool ok = fstat(fd, &st) == 0;
+            if (ok && st.st_size > 0) {
+                void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                ok = p != MAP_FAILED;
+                if (ok) {
+                    data = static_cast<const unsigned char*>(p);
+                    size = st.st_size;
+                }
+            }
+            ::close(fd);
+            return ok;
+#else
+            std::ifstream in(file, std::ios::binary);
+            if (!in) return false;
+            copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            data = copy.data();
+            size = copy.size();
+            return true;
+#endif
+        }
+
+        std::uint64_t u32(std::uint64_t at) const {
+            if (at + 4 > size) bad();
+            std::uint32_t v = fasta_detail::read_le(data + at, 4);
+            if (swapped) v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+            return v;
+        }
+
+        std::uint64_t u64(std::uint64_t at) const {
+            std::uint64_t lo = u32(at), hi = u32(at + 4);
+            return swapped ? (lo << 32) | hi : (hi << 32) | lo;
+        }
+
+        void parse() {
+            if (u32(0) != TWOBIT_SIGNATURE) {
+                swapped = true;
+                if (u32(0) != TWOBIT_SIGNATURE) bad();
+            }
+            std::uint64_t version = u32(4);
+            if (version > 1) bad();
+            std::uint64_t count = u32(8);
+
+            std::uint64_t at = 16;
+            for (std::uint64_t i = 0; i < count; i++) {
+                if (at >= size) bad();
+                std::size_t len = data[at++];
+                if (at + len > size) bad();
+                std::string name(reinterpret_cast<const char*>(data + at), len);
+                at += len;
+                std::uint64_t offset = version ? u64(at) : u32(at);
+                at += version ? 8 : 4;
+
+                Record rec;
+                rec.dna_size = u32(offset);
+                rec.n_count = u32(offset + 4);
+                rec.n_blocks = data + offset + 8;
+                std::uint64_t p = offset + 8 + 8ull * rec.n_count;
+                rec.mask_count = u32(p);
+                rec.mask_blocks = data + p + 4;
+                p += 4 + 8ull * rec.mask_count + 4;
+                if (p + (rec.dna_size + 3) / 4 > size) bad();
+                rec.dna = data + p;
+
+                lookup.emplace(name, seqs.size());
+                seq_names.push_back(std::move(name));
+                seqs.push_back(rec);
+            }
+        }
+
+        const Record& record(const std::string& name) const {
+            auto it = lookup.find(name);
+            if (it == lookup.end()) throw std::runtime_error("No such record: " + name);
+            return seqs[it->second];
+        }
+
+        const Record& checked(const std::string& name, std::size_t start, std::size_t end) const {
+            const Record& rec = record(name);
+            if (start == 0 || end < start) {
+                throw std::runtime_error("Invalid coordinates");
+            }
+            if (end > rec.dna_size) {
+                throw std::runtime_error("End coordinate out of bounds");
+            }
+            return rec;
+        }
+
+        void unpack(const Record& rec, std::size_t pos, std::size_t n, char* dst, bool caps) const {
+            fasta_detail::unpack_bases(rec.dna, pos, n, dst);
+            overlay(rec.n_blocks, rec.n_count, pos, n, dst, false);
+            if (!caps) overlay(rec.mask_blocks, rec.mask_count, pos, n, dst, true);
+        }
+
+        // applies the blocks overlapping [pos, pos + n) to dst. blocks holds
+        // count starts followed by count sizes.
+        void overlay(const unsigned char* blocks, std::uint32_t count, std::size_t pos, std::size_t n,
+                char* dst, bool lower) const {
+            std::uint64_t starts = blocks - data;
+            std::uint64_t sizes = starts + 4ull * count;
+            // the first block ending after pos
+            std::uint32_t lo = 0, hi = count;
+            while (lo < hi) {
+                std::uint32_t mid = lo + (hi - lo) / 2;
+                if (u32(starts + 4ull * mid) + u32(sizes + 4ull * mid) <= pos) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            for (std::uint32_t i = lo; i < count; i++) {
+                std::size_t a = u32(starts + 4ull * i);
+                if (a >= pos + n) break;
+                std::size_t b = std::min<std::size_t>(a + u32(sizes + 4ull * i), pos + n);
+                for (std::size_t j = std::max(a, pos); j < b; j++) {
+                    dst[j - pos] = lower ? fasta_detail::to_lower(dst[j - pos]) : 'N';
+                }
+            }
+        }
+
+        [[noreturn]] void bad() const {
+            throw std::runtime_error("Malformed .2bit file " + file);
+        }
+
+        // writes the file with version's offset size. a version 0 file stops
+        // with fits cleared once a record starts past 32 bits.
+        static bool write_records(const FASTAFile& fa, const std::string& filename, int version, bool& fits) {
+            const std::vector<FASTAIndexEntry>& recs = fa.index();
+            int offset_size = version ? 8 : 4;
+            fits = true;
+
+            std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            fasta_detail::write_le(out, TWOBIT_SIGNATURE, 4);
+            fasta_detail::write_le(out, version, 4);
+            fasta_detail::write_le(out, recs.size(), 4);
+            fasta_detail::write_le(out, 0, 4);
+            std::streamoff table = out.tellp();
+            for (const auto& r : recs) {
+                out.put(static_cast<char>(r.name.size()));
+                out.write(r.name.data(), r.name.size());
+                fasta_detail::write_le(out, 0, offset_size);
+            }
+
+            std::vector<std::uint64_t> offsets;
+            for (const auto& r : recs) {
+                offsets.push_back(out.tellp());
+                if (version == 0 && offsets.back() > 0xffffffffu) {
+                    fits = false;
+                    return true;
+                }
+                PackedSequence seq(fa, r.name);
+                std::vector<PackedSequence::Block> ns = merge_blocks(seq.n_blocks(), seq.other_blocks());
+                fasta_detail::write_le(out, seq.size(), 4);
+                write_blocks(out, ns);
+                write_blocks(out, seq.mask_blocks());
+                fasta_detail::write_le(out, 0, 4);
+                out.write(reinterpret_cast<const char*>(seq.packed().data()), seq.packed().size());
+            }
+
+            out.seekp(table);
+            for (std::size_t i = 0; i < recs.size(); i++) {
+                out.put(static_cast<char>(recs[i].name.size()));
+                out.write(recs[i].name.data(), recs[i].name.size());
+                fasta_detail::write_le(out, offsets[i], offset_size);
+            }
+            return static_cast<bool>(out.flush());
+        }
+
+        static std::vector<PackedSequence::Block> merge_blocks(const std::vector<PackedSequence::Block>& a,
+                const std::vector<PackedSequence::Block>& b) {
+            std::vector<PackedSequence::Block> all(a.size() + b.size());
+            std::merge(a.begin(), a.end(), b.begin(), b.end(), all.begin(),
+                [](const PackedSequence::Block& x, const PackedSequence::Block& y) { return x.start < y.start; });
+            std::vector<PackedSequence::Block> ret;
+            for (const auto& blk : all) {
+                if (!ret.empty() && ret.back().start + ret.back().length == blk.start) {
+                    ret.back().length += blk.length;
+                } else {
+                    ret.push_back(blk);
+                }
+            }
+            return ret;
+        }
+
+        static void write_blocks(std::ostream& out, const std::vector<PackedSequence::Block>& blocks) {
+            fasta_detail::write_le(out, blocks.size(), 4);
+            for (const auto& b : blocks) fasta_detail::write_le(out, b.start, 4);
+            for (const auto& b : blocks) fasta_detail::write_le(out, b.length, 4);
+        }
 };
 
 #endif /* FASTA_H */